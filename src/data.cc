@@ -1,4 +1,9 @@
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <random>
 #include "data.h"
+#include "parallel.h"
 #include "nine2five.h"
 #include "predictor.h"
 
@@ -9,11 +14,13 @@ using namespace nine2five;
 Record::Record (const Dtime& dtime,
                 const Wind& wind_925,
                 const Real temperature_925,
-                const Wind& wind)
+                const Wind& wind,
+                const Extra_Schema::Values& extra)
    : dtime (dtime),
      wind_925 (wind_925),
      temperature_925 (temperature_925),
-     wind (wind)
+     wind (wind),
+     extra (extra)
 {
 }
 
@@ -41,12 +48,152 @@ Record::Set::feed (Wind_Rose& wind_rose) const
    for (const Record& record : *this) { wind_rose.add_wind (record.wind); }
 }
 
-Sample*
-Record::Set::get_temperature_925_sample_ptr () const
+Record::Columns::Columns ()
+   : total_weight (0)
 {
-   Tuple tuple;
-   for (const Record& r : *this) { tuple.push_back (r.temperature_925); }
-   return new Sample (tuple);
+}
+
+Record::Columns::Columns (const Record::Set& record_set)
+   : total_weight (0)
+{
+   for (const Record& record : record_set) { add (record); }
+}
+
+Record::Columns::Columns (const Columns& columns,
+                          const Tuple& weight_tuple,
+                          const Real min_weight)
+   : total_weight (0)
+{
+
+   for (Integer k = 0; k < columns.size (); k++)
+   {
+
+      const Real weight = weight_tuple[k];
+      if (weight < min_weight) { continue; }
+
+      dtime_tuple.push_back (columns.dtime_tuple[k]);
+      wind_tuple.push_back (columns.wind_tuple[k]);
+      direction_tuple.push_back (columns.direction_tuple[k]);
+      speed_tuple.push_back (columns.speed_tuple[k]);
+      temperature_925_tuple.push_back (columns.temperature_925_tuple[k]);
+      direction_925_tuple.push_back (columns.direction_925_tuple[k]);
+      speed_925_tuple.push_back (columns.speed_925_tuple[k]);
+      Extra_Schema::push_back (extra_tuples,
+         Extra_Schema::get_values (columns.extra_tuples, k));
+      this->weight_tuple.push_back (weight);
+      total_weight += weight;
+
+   }
+
+}
+
+void
+Record::Columns::add (const Record& record,
+                      const Real weight)
+{
+   const Real multiplier = 0.51444444;
+   const Wind& wind = record.wind;
+   const Wind& wind_925 = record.wind_925;
+   dtime_tuple.push_back (record.dtime);
+   wind_tuple.push_back (wind);
+   direction_tuple.push_back (wind.get_direction ());
+   speed_tuple.push_back (wind.get_speed () / multiplier);
+   temperature_925_tuple.push_back (record.temperature_925);
+   direction_925_tuple.push_back (wind_925.get_direction ());
+   speed_925_tuple.push_back (wind_925.get_speed () / multiplier);
+   Extra_Schema::push_back (extra_tuples, record.extra);
+   weight_tuple.push_back (weight);
+   total_weight += weight;
+}
+
+Integer
+Record::Columns::size () const
+{
+   return dtime_tuple.size ();
+}
+
+Real
+Record::Columns::get_total_weight () const
+{
+   return total_weight;
+}
+
+Record::Projection::Projection (const Real dir_scatter)
+   : columns_ptr (nullptr),
+     dir_scatter (dir_scatter)
+{
+}
+
+Real
+Record::Projection::get_jitter (const Dtime& dtime)
+{
+
+   // splitmix64 of the time stamp, so the noise belongs to the record
+   uint64_t z;
+   const double t = dtime.t;
+   memcpy (&z, &t, sizeof (z));
+   z += 0x9e3779b97f4a7c15ULL;
+   z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+   z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+   z = z ^ (z >> 31);
+
+   return Real (z >> 11) / Real (1ULL << 52) - 1;
+
+}
+
+void
+Record::Projection::clear ()
+{
+   columns_ptr = nullptr;
+   jitter_tuple.clear ();
+   point_tuple.clear ();
+   noisy_point_tuple.clear ();
+   point_925_tuple.clear ();
+}
+
+bool
+Record::Projection::is_current (const Columns& columns,
+                                const Transform_2D& transform) const
+{
+   if (columns_ptr != &columns) { return false; }
+   if (point_tuple.size () != columns.size ()) { return false; }
+   const Point_2D& a = transform.transform (Point_2D (0, 10));
+   const Point_2D& b = transform.transform (Point_2D (90, 20));
+   return (a.x == reference_a.x && a.y == reference_a.y &&
+           b.x == reference_b.x && b.y == reference_b.y);
+}
+
+void
+Record::Projection::project (const Columns& columns,
+                             const Transform_2D& transform)
+{
+
+   clear ();
+
+   const Integer n = columns.size ();
+   jitter_tuple.resize (n);
+   point_tuple.resize (n);
+   noisy_point_tuple.resize (n);
+   point_925_tuple.resize (n);
+
+   for (Integer k = 0; k < n; k++)
+   {
+      const Real direction = columns.direction_tuple[k];
+      const Real speed = columns.speed_tuple[k];
+      const Real jitter = get_jitter (columns.dtime_tuple[k]) * dir_scatter;
+      const Real d_925 = columns.direction_925_tuple[k];
+      const Real s_925 = columns.speed_925_tuple[k];
+      jitter_tuple[k] = jitter;
+      point_tuple[k] = transform.transform (Point_2D (direction, speed));
+      noisy_point_tuple[k] = transform.transform (
+         Point_2D (direction + jitter, speed));
+      point_925_tuple[k] = transform.transform (Point_2D (d_925, s_925));
+   }
+
+   columns_ptr = &columns;
+   reference_a = transform.transform (Point_2D (0, 10));
+   reference_b = transform.transform (Point_2D (90, 20));
+
 }
 
 Record::Daily::Daily ()
@@ -109,7 +256,8 @@ Station_Data::Station_Data ()
 }
 
 void
-Station_Data::read (const Dstring& file_path)
+Station_Data::read (const Dstring& file_path,
+                    const function<bool ()>& is_cancelled)
 {
 
    igzstream file (file_path.get_string ());
@@ -117,6 +265,8 @@ Station_Data::read (const Dstring& file_path)
    for (string il; std::getline (file, il); )
    {
 
+      if (is_cancelled && is_cancelled ()) { break; }
+
       const Dstring input_line (il);
       const Tokens tokens (input_line, ":");
 
@@ -133,7 +283,8 @@ Station_Data::read (const Dstring& file_path)
 
       const Integer j = stoi (dtime.get_string ("%j"));
       const Integer h = stoi (dtime.get_string ("%H"));
-      const Record record (dtime, wind_925, temperature_925, wind);
+      const Extra_Schema::Values& extra = Extra_Schema::parse (tokens, 6);
+      const Record record (dtime, wind_925, temperature_925, wind, extra);
 
       add (j, h, record);
 
@@ -149,7 +300,9 @@ Station_Data::get_record_set_ptr (const Integer day_of_year,
                                   const Integer hour,
                                   const Integer hour_threshold,
                                   const Wind& wind_925,
-                                  const Real threshold) const
+                                  const Real threshold,
+                                  const Extra_Schema::Query& extra_query,
+                                  const function<bool ()>& is_cancelled) const
 {
 
    const Integer n = 365;
@@ -160,6 +313,7 @@ Station_Data::get_record_set_ptr (const Integer day_of_year,
 
       const Integer j = jj->first;
       const Record::Daily& daily = jj->second;
+      if (is_cancelled && is_cancelled ()) { break; }
 
       if (!Record::Daily::match_day_of_year (
          j, day_of_year, day_of_year_threshold))
@@ -184,7 +338,9 @@ Station_Data::get_record_set_ptr (const Integer day_of_year,
             const bool match = wind_925.is_naw () ||
                                gsl_isnan (threshold) ||
                                (difference.get_speed () < threshold);
-            if (match) { record_set_ptr->insert (record); }
+            if (!match) { continue; }
+            if (!Extra_Schema::match (record.extra, extra_query)) { continue; }
+            record_set_ptr->insert (record);
          }
 
       }
@@ -195,6 +351,258 @@ Station_Data::get_record_set_ptr (const Integer day_of_year,
 
 }
 
+Archive::Archive (const Station_Data& station_data)
+   : time_step (GSL_NAN)
+{
+
+   for (auto& jj : station_data)
+   {
+      const Integer j = jj.first;
+      for (auto& hh : jj.second)
+      {
+         const Integer h = hh.first;
+         for (const Record& record : hh.second)
+         {
+            add (record);
+            day_of_year_tuple.push_back (j);
+            hour_tuple.push_back (h);
+         }
+      }
+   }
+
+   const Integer n = size ();
+   u_925_tuple.resize (n);
+   v_925_tuple.resize (n);
+
+   for (Integer k = 0; k < n; k++)
+   {
+      const Real theta = direction_925_tuple[k] * M_PI / 180;
+      u_925_tuple[k] = -speed_925_tuple[k] * sin (theta);
+      v_925_tuple[k] = -speed_925_tuple[k] * cos (theta);
+   }
+
+   // records come by day of year and hour, not in time order
+   vector<int64_t> minutes_tuple;
+   for (const Dtime& dtime : dtime_tuple)
+   {
+      minutes_tuple.push_back (llround (dtime.t * 60));
+   }
+   sort (minutes_tuple.begin (), minutes_tuple.end ());
+   minutes_tuple.erase (unique (minutes_tuple.begin (),
+      minutes_tuple.end ()), minutes_tuple.end ());
+
+   map<int64_t, Integer> gap_map;
+   for (Integer k = 1; k < minutes_tuple.size (); k++)
+   {
+      gap_map[minutes_tuple[k] - minutes_tuple[k - 1]]++;
+   }
+
+   Integer max_count = 0;
+   for (const auto& gap : gap_map)
+   {
+      if (gap.second <= max_count) { continue; }
+      max_count = gap.second;
+      time_step = gap.first / 60.0;
+   }
+
+}
+
+Tuple
+Archive::get_weight_tuple (const Integer day_of_year,
+                           const Real day_of_year_scale,
+                           const Integer hour,
+                           const Real hour_scale,
+                           const Wind& wind_925,
+                           const Real wind_925_scale,
+                           const Extra_Schema::Query& extra_query,
+                           const function<bool ()>& is_cancelled) const
+{
+
+   // Gaussian kernels on the cyclic calendar and hour distances and on
+   // the 925 hPa vector wind difference in knots; the hard thresholds
+   // become the kernel scales
+   const Integer n = size ();
+   const Real multiplier = 0.51444444;
+   const bool no_wind_925 = wind_925.is_naw () || gsl_isnan (wind_925_scale);
+   const Real direction = wind_925.get_direction ();
+   const Real speed = wind_925.get_speed () / multiplier;
+   const Real theta = direction * M_PI / 180;
+   const Real u = -speed * sin (theta);
+   const Real v = -speed * cos (theta);
+
+   const Real a_j = -0.5 / (day_of_year_scale * day_of_year_scale);
+   const Real a_h = -0.5 / (hour_scale * hour_scale);
+   const Real a_w = -0.5 / (wind_925_scale * wind_925_scale);
+
+   Tuple weight_tuple;
+   weight_tuple.resize (n);
+   const Chunks chunks (n);
+
+   chunks.run ([&] (const Integer c)
+   {
+      if (is_cancelled && is_cancelled ()) { return; }
+      for (Integer k = chunks.get_start (c); k < chunks.get_end (c); k++)
+      {
+         const Integer dj = abs (day_of_year_tuple[k] - day_of_year);
+         const Integer dh = abs (hour_tuple[k] - hour);
+         const Real j = std::min (dj, 365 - dj);
+         const Real h = std::min (dh, 24 - dh);
+         const Real du = u_925_tuple[k] - u;
+         const Real dv = v_925_tuple[k] - v;
+         const Real w = (no_wind_925 ? 0 : a_w * (du * du + dv * dv));
+         const Real x = Extra_Schema::get_exponent (
+            Extra_Schema::get_values (extra_tuples, k), extra_query);
+         weight_tuple[k] = exp (a_j * j * j + a_h * h * h + w + x);
+      }
+   });
+
+   return weight_tuple;
+
+}
+
+Trajectory_Index::Trajectory_Index (const Archive& archive,
+                                    const Tuple& lag_tuple,
+                                    const Real cell_size)
+   : archive (archive),
+     lag_tuple (lag_tuple),
+     cell_size (cell_size)
+{
+
+   const Integer n = archive.size ();
+   const Integer nl = lag_tuple.size ();
+
+   // records by time in minutes, to find the hours before each one
+   map<int64_t, Integer> time_map;
+   for (Integer k = 0; k < n; k++)
+   {
+      const int64_t minutes = llround (archive.dtime_tuple[k].t * 60);
+      time_map[minutes] = k;
+   }
+
+   for (Integer k = 0; k < n; k++)
+   {
+
+      Tuple u_tuple, v_tuple;
+      Real mean_u = 0, mean_v = 0;
+      const Real t = archive.dtime_tuple[k].t;
+
+      for (const Real lag : lag_tuple)
+      {
+         auto iterator = time_map.find (llround ((t - lag) * 60));
+         if (iterator == time_map.end ()) { break; }
+         const Integer i = iterator->second;
+         const Real u = archive.u_925_tuple[i];
+         const Real v = archive.v_925_tuple[i];
+         if (gsl_isnan (u) || gsl_isnan (v)) { break; }
+         u_tuple.push_back (u);
+         v_tuple.push_back (v);
+         mean_u += u / nl;
+         mean_v += v / nl;
+      }
+
+      // only complete windows are indexed
+      if (u_tuple.size () != nl) { continue; }
+
+      const Integer m = record_tuple.size ();
+      record_tuple.push_back (k);
+      window_u_tuple.insert (window_u_tuple.end (), u_tuple.begin (), u_tuple.end ());
+      window_v_tuple.insert (window_v_tuple.end (), v_tuple.begin (), v_tuple.end ());
+      bucket_map[get_cell (mean_u, mean_v)].push_back (m);
+
+   }
+
+}
+
+Trajectory_Index::Cell
+Trajectory_Index::get_cell (const Real u,
+                            const Real v) const
+{
+   const Integer i = Integer (floor (u / cell_size));
+   const Integer j = Integer (floor (v / cell_size));
+   return Cell (i, j);
+}
+
+const Tuple&
+Trajectory_Index::get_lag_tuple () const
+{
+   return lag_tuple;
+}
+
+Integer
+Trajectory_Index::size () const
+{
+   return record_tuple.size ();
+}
+
+Tuple
+Trajectory_Index::get_weight_tuple (const Tuple& u_tuple,
+                                    const Tuple& v_tuple,
+                                    const Real threshold,
+                                    const Integer day_of_year,
+                                    const Integer day_of_year_threshold,
+                                    const Integer hour,
+                                    const Integer hour_threshold,
+                                    const function<bool ()>& is_cancelled) const
+{
+
+   const Integer nl = lag_tuple.size ();
+   Tuple weight_tuple;
+   weight_tuple.resize (archive.size (), 0);
+
+   Real mean_u = 0, mean_v = 0;
+   for (Integer l = 0; l < nl; l++)
+   {
+      mean_u += u_tuple[l] / nl;
+      mean_v += v_tuple[l] / nl;
+   }
+
+   const Cell& start = get_cell (mean_u - threshold, mean_v - threshold);
+   const Cell& end = get_cell (mean_u + threshold, mean_v + threshold);
+   const Real threshold_2 = threshold * threshold * nl;
+
+   for (Integer i = start.first; i <= end.first; i++)
+   {
+
+      for (Integer j = start.second; j <= end.second; j++)
+      {
+
+         // checked once per cell
+         if (is_cancelled && is_cancelled ()) { return weight_tuple; }
+
+         auto iterator = bucket_map.find (Cell (i, j));
+         if (iterator == bucket_map.end ()) { continue; }
+
+         for (const Integer m : iterator->second)
+         {
+
+            const Integer k = record_tuple[m];
+            const Integer jj = archive.day_of_year_tuple[k];
+            const Integer hh = archive.hour_tuple[k];
+            if (!Record::Daily::match_day_of_year (
+               jj, day_of_year, day_of_year_threshold)) { continue; }
+            if (!Record::Daily::match_hour (hh, hour, hour_threshold)) { continue; }
+
+            // rms vector difference over the window, without the root
+            Real sum = 0;
+            for (Integer l = 0; l < nl && sum < threshold_2; l++)
+            {
+               const Real du = window_u_tuple[m * nl + l] - u_tuple[l];
+               const Real dv = window_v_tuple[m * nl + l] - v_tuple[l];
+               sum += du * du + dv * dv;
+            }
+
+            if (sum < threshold_2) { weight_tuple[k] = 1; }
+
+         }
+
+      }
+
+   }
+
+   return weight_tuple;
+
+}
+
 void
 Data::survey ()
 {
@@ -225,6 +633,12 @@ Data::get_station_tokens () const
    return station_tokens;
 }
 
+Dstring
+Data::get_file_path (const Dstring& station) const
+{
+   return data_path + "/" + station + ".gz";
+}
+
 Station_Data&
 Data::get_station_data (const Dstring& station)
 {
@@ -243,242 +657,2220 @@ Data::get_station_data (const Dstring& station)
       insert (make_pair (station, station_data));
 
       Station_Data& sd = find (station)->second;
-      const string& file_path = data_path + "/" + station + ".gz";
-      sd.read (file_path);
+      sd.read (get_file_path (station));
       return sd;
 
    }
 
 }
 
-Cluster::Cluster ()
-   : histogram (1, 0.5),
-     mean_wind (GSL_NAN, GSL_NAN)
+void
+Data::add_station_data (const Dstring& station,
+                        Station_Data& station_data)
 {
+   if (find (station) != end ()) { return; }
+   Station_Data& sd = (*this)[station];
+   sd.swap (station_data);
 }
 
-Gaussian_Distribution
-Cluster::get_gaussian_distribution () const
+Extent::Extent ()
+   : start_x (GSL_POSINF),
+     end_x (GSL_NEGINF),
+     start_y (GSL_POSINF),
+     end_y (GSL_NEGINF)
 {
-   const Sample sample (tuple);
-   const Real mean = sample.get_mean ();
-   const Real variance = sample.get_variance ();
-   return Gaussian_Distribution (mean, variance);
 }
 
-Real
-Cluster::get_likelihood (const Real temperature_925,
-                         const Integer n) const
+bool
+Extent::is_empty () const
 {
-   if (tuple.size () < 2) { return 0; }
-   const Gaussian_Distribution& gd = get_gaussian_distribution ();
-   const Real pdf = gd.get_pdf (temperature_925);
-   const Real share = Real (tuple.size ()) / Real (n);
-   return pdf * share;
+   return (start_x > end_x || start_y > end_y);
 }
 
-Clusters::Clusters ()
-   : defining (-1)
+bool
+Extent::contains (const Point_2D& point) const
 {
+   return (point.x >= start_x && point.x <= end_x &&
+           point.y >= start_y && point.y <= end_y);
 }
 
-Clusters::~Clusters ()
+void
+Extent::extend (const Point_2D& point)
 {
-   clear ();
+   start_x = std::min (start_x, point.x);
+   end_x = std::max (end_x, point.x);
+   start_y = std::min (start_y, point.y);
+   end_y = std::max (end_y, point.y);
 }
 
-bool
-Clusters::is_defining () const
+void
+Extent::extend (const Extent& extent)
 {
-   return (defining >= 0);
+   if (extent.is_empty ()) { return; }
+   start_x = std::min (start_x, extent.start_x);
+   end_x = std::max (end_x, extent.end_x);
+   start_y = std::min (start_y, extent.start_y);
+   end_y = std::max (end_y, extent.end_y);
 }
 
-Integer
-Clusters::get_index (const Point_2D& point) const
+Moments::Moments ()
+   : n (0),
+     mean (0),
+     m2 (0)
 {
+}
 
-   for (Integer i = 0; i < size (); i++)
-   {
-      const Cluster& cluster = get_cluster (i);
-      const bool b = cluster.contains (point);
-      if (b) { return i; }
-   }
-
-   return -1;
+void
+Moments::clear ()
+{
+   n = 0;
+   mean = 0;
+   m2 = 0;
+}
 
+void
+Moments::add (const Real value,
+              const Real weight)
+{
+   if (gsl_isnan (value)) { return; }
+   n += weight;
+   const Real delta = value - mean;
+   mean += delta * weight / n;
+   m2 += weight * delta * (value - mean);
 }
 
-Cluster&
-Clusters::get_cluster (const Integer index)
+void
+Moments::remove (const Real value,
+                 const Real weight)
 {
-   return *at (index);
+   if (gsl_isnan (value)) { return; }
+   if (n - weight < 1e-9) { clear (); return; }
+   const Real old_mean = mean;
+   n -= weight;
+   mean = old_mean + (old_mean - value) * weight / n;
+   m2 = std::max (m2 - weight * (value - mean) * (value - old_mean), 0.0);
 }
 
-const Cluster&
-Clusters::get_cluster (const Integer index) const
+void
+Moments::merge (const Moments& moments)
 {
-   return *at (index);
+   if (moments.n < 1e-9) { return; }
+   const Real total = n + moments.n;
+   const Real delta = moments.mean - mean;
+   m2 += moments.m2 + delta * delta * n * moments.n / total;
+   mean += delta * moments.n / total;
+   n = total;
 }
 
-Cluster&
-Clusters::get_cluster (const Point_2D& point)
+void
+Moments::subtract (const Moments& moments)
 {
-   const Integer i = get_index (point);
-   if (i < 0) { throw Exception ("No matching cluster."); }
-   return get_cluster (i);
+   if (moments.n < 1e-9) { return; }
+   const Real rest = n - moments.n;
+   if (rest < 1e-9) { clear (); return; }
+   const Real rest_mean = (n * mean - moments.n * moments.mean) / rest;
+   const Real delta = moments.mean - rest_mean;
+   m2 -= moments.m2 + delta * delta * rest * moments.n / n;
+   m2 = std::max (m2, 0.0);
+   mean = rest_mean;
+   n = rest;
 }
 
-const Cluster&
-Clusters::get_cluster (const Point_2D& point) const
+Real
+Moments::get_mean () const
 {
-   const Integer i = get_index (point);
-   if (i < 0) { throw Exception ("No matching cluster."); }
-   return get_cluster (i);
+   return (n > 0 ? mean : GSL_NAN);
 }
 
-Cluster&
-Clusters::get_defining_cluster ()
+Real
+Moments::get_variance () const
 {
-   return *at (defining);
+   return (n > 1 ? m2 / (n - 1) : GSL_NAN);
 }
 
-const Cluster&
-Clusters::get_defining_cluster (const Integer index) const
+Real
+Moments::get_sd () const
 {
-   return *at (defining);
+   return sqrt (get_variance ());
 }
 
-void
-Clusters::add (const Point_2D& point,
-               const Integer index)
+Weighted_Histogram::Weighted_Histogram (const Real delta,
+                                        const Real offset)
+   : delta (delta),
+     offset (offset),
+     number_of_points (0)
 {
-   this->defining = (index < 0 ? size () : index);
-   get_cluster (defining).add (point);
 }
 
-void
-Clusters::remove (const Integer index)
+Integer
+Weighted_Histogram::get_bin (const Real value) const
 {
-   const Integer i = (index < 0 ? defining : index);
-   if (i < 0 || i > size () - 1) { return; }
-   erase (begin () + i);
-   if (i == defining) { defining = -1; }
+   return Integer (floor ((value - offset) / delta));
 }
 
-void
-Clusters::clear ()
+Real
+Weighted_Histogram::get_edge (const Integer bin) const
 {
-   for (Cluster* cluster_ptr : *this) { delete cluster_ptr; }
-   vector<Cluster*>::clear ();
-   defining = -1;
+   return offset + bin * delta;
 }
 
 void
-Clusters::reset ()
+Weighted_Histogram::clear ()
 {
-   for (Cluster* cluster_ptr : *this)
-   {
-      Cluster& cluster = *cluster_ptr;
-      cluster.tuple.clear ();
-      cluster.mean_wind = Wind (GSL_NAN, GSL_NAN);
-   }
+   map<Integer, Real>::clear ();
+   number_of_points = 0;
 }
 
 void
-Clusters::render (const RefPtr<Context>& cr,
-                  const Real alpha) const
+Weighted_Histogram::increment (const Real value,
+                               const Real weight)
 {
-
-   cr->save ();
-   cr->set_line_width (6);
-   Dashes ("2:10").cairo (cr);
-
-   for (Integer i = 0; i < size (); i++)
-   {
-      Color (i, alpha).cairo (cr);
-      at (i)->cairo (cr);
-      cr->stroke ();
-   }
-
-   cr->restore ();
-
+   if (gsl_isnan (value)) { return; }
+   (*this)[get_bin (value)] += weight;
+   number_of_points += weight;
 }
 
 void
-Clusters::render_defining (const RefPtr<Context>& cr) const
+Weighted_Histogram::decrement (const Real value,
+                               const Real weight)
 {
 
-   if (defining < 0) { return; }
-
-   cr->save ();
-   cr->set_line_width (6);
-   Dashes ("2:10").cairo (cr);
+   if (gsl_isnan (value)) { return; }
 
-   const Cluster& cluster = get_cluster (defining);
-   Color (defining).cairo (cr);
-   cluster.cairo (cr);
-   cr->stroke ();
+   const Integer bin = get_bin (value);
+   auto iterator = find (bin);
+   if (iterator == end ()) { return; }
 
-   cr->restore ();
+   iterator->second -= weight;
+   number_of_points -= weight;
+   if (iterator->second < 1e-9) { erase (iterator); }
 
 }
 
 void
-Clusters::cluster_analysis (const Record::Set& record_set,
-                            const Transform_2D& transform,
-                            const Predictor& predictor)
+Weighted_Histogram::merge (const Weighted_Histogram& histogram)
 {
+   for (auto& i : histogram) { (*this)[i.first] += i.second; }
+   number_of_points += histogram.number_of_points;
+}
 
+Real
+Weighted_Histogram::get_number_of_points () const
+{
+   return number_of_points;
+}
+
+Real
+Weighted_Histogram::get_max_value () const
+{
+   Real max_value = 0;
+   for (auto& i : *this) { max_value = std::max (max_value, i.second); }
+   return max_value;
+}
+
+void
+Weighted_Histogram::render_outline (const RefPtr<Context>& cr,
+                                    const Transform_2D& transform) const
+{
+
+   if (empty ()) { return; }
+
+   const Integer start_bin = begin ()->first;
+   const Integer end_bin = rbegin ()->first;
+
+   Point_2D p = transform.transform (Point_2D (0, get_edge (start_bin)));
+   cr->move_to (p.x, p.y);
+
+   for (Integer bin = start_bin; bin <= end_bin; bin++)
+   {
+      auto iterator = find (bin);
+      const Real value = (iterator == end () ? 0 : iterator->second);
+      p = transform.transform (Point_2D (value, get_edge (bin)));
+      cr->line_to (p.x, p.y);
+      p = transform.transform (Point_2D (value, get_edge (bin + 1)));
+      cr->line_to (p.x, p.y);
+   }
+
+   p = transform.transform (Point_2D (0, get_edge (end_bin + 1)));
+   cr->line_to (p.x, p.y);
+   cr->stroke ();
+
+}
+
+Kernel_Density::Kernel_Density (const Real start,
+                                const Real end,
+                                const Real delta)
+   : start (start),
+     delta (delta),
+     count_tuple (Integer (round ((end - start) / delta)) + 1, 0),
+     density_tuple (count_tuple.size (), 0),
+     number_of_points (0),
+     bandwidth (GSL_NAN),
+     smoothed (false)
+{
+}
+
+void
+Kernel_Density::clear ()
+{
+   fill (count_tuple.begin (), count_tuple.end (), 0);
+   fill (density_tuple.begin (), density_tuple.end (), 0);
+   number_of_points = 0;
+   smoothed = false;
+}
+
+void
+Kernel_Density::increment (const Real value,
+                           const Real weight)
+{
+
+   if (gsl_isnan (value)) { return; }
+
+   // linear binning, values off the grid pile up at its ends
+   const Integer n = count_tuple.size ();
+   const Real x = bound ((value - start) / delta, Real (n - 1), 0.0);
+   const Integer i = std::min (Integer (floor (x)), n - 2);
+   const Real f = x - i;
+
+   count_tuple[i] += weight * (1 - f);
+   count_tuple[i + 1] += weight * f;
+   number_of_points += weight;
+   smoothed = false;
+
+}
+
+void
+Kernel_Density::decrement (const Real value,
+                           const Real weight)
+{
+   increment (value, -weight);
+}
+
+void
+Kernel_Density::merge (const Kernel_Density& kernel_density)
+{
+   const vector<Real>& ct = kernel_density.count_tuple;
+   for (Integer i = 0; i < ct.size (); i++) { count_tuple[i] += ct[i]; }
+   number_of_points += kernel_density.number_of_points;
+   smoothed = false;
+}
+
+Real
+Kernel_Density::get_bandwidth (const Moments& moments)
+{
+   // Silverman's rule of thumb
+   return 1.06 * moments.get_sd () * pow (moments.n, -0.2);
+}
+
+void
+Kernel_Density::smooth (const Real bandwidth)
+{
+
+   if (smoothed && bandwidth == this->bandwidth) { return; }
+
+   this->bandwidth = bandwidth;
+   this->smoothed = true;
+   fill (density_tuple.begin (), density_tuple.end (), 0);
+   if (!(bandwidth > 0) || number_of_points < 1e-9) { return; }
+
+   const Integer n = count_tuple.size ();
+   const Integer w = Integer (ceil (4 * bandwidth / delta));
+   const Real a = 1 / (sqrt (2 * M_PI) * bandwidth * number_of_points);
+
+   vector<Real> kernel (w + 1);
+   for (Integer j = 0; j <= w; j++)
+   {
+      const Real z = j * delta / bandwidth;
+      kernel[j] = a * exp (-0.5 * z * z);
+   }
+
+   // only occupied bins are spread out
+   for (Integer i = 0; i < n; i++)
+   {
+      const Real count = count_tuple[i];
+      if (fabs (count) < 1e-9) { continue; }
+      const Integer start_j = std::max (-w, -i);
+      const Integer end_j = std::min (w, n - 1 - i);
+      for (Integer j = start_j; j <= end_j; j++)
+      {
+         density_tuple[i + j] += count * kernel[abs (j)];
+      }
+   }
+
+}
+
+Real
+Kernel_Density::get_density (const Real value) const
+{
+
+   if (!smoothed || gsl_isnan (value)) { return GSL_NAN; }
+
+   const Integer n = density_tuple.size ();
+   const Real x = (value - start) / delta;
+   if (x < 0 || x > n - 1) { return 0; }
+
+   const Integer i = std::min (Integer (floor (x)), n - 2);
+   const Real f = x - i;
+   return density_tuple[i] * (1 - f) + density_tuple[i + 1] * f;
+
+}
+
+void
+Kernel_Density::render (const RefPtr<Context>& cr,
+                        const Transform_2D& transform,
+                        const Real bin_size) const
+{
+
+   if (!smoothed || number_of_points < 1e-9) { return; }
+
+   // the curve is scaled to counts per histogram bin
+   const Real scale = number_of_points * bin_size;
+   const Integer n = density_tuple.size ();
+
+   Integer start_i = 0;
+   Integer end_i = n - 1;
+   while (start_i < n && density_tuple[start_i] * scale < 1e-3) { start_i++; }
+   while (end_i > start_i && density_tuple[end_i] * scale < 1e-3) { end_i--; }
+   if (start_i >= end_i) { return; }
+
+   for (Integer i = start_i; i <= end_i; i++)
+   {
+      const Real t = start + i * delta;
+      const Point_2D& p = transform.transform (
+         Point_2D (density_tuple[i] * scale, t));
+      if (i == start_i) { cr->move_to (p.x, p.y); }
+      else { cr->line_to (p.x, p.y); }
+   }
+
+   cr->stroke ();
+
+}
+
+static std::atomic<Integer>
+next_cluster_id (0);
+
+// whether segments ab and cd meet, touching included
+static bool
+meets (const Point_2D& a,
+       const Point_2D& b,
+       const Point_2D& c,
+       const Point_2D& d)
+{
+
+   auto orientation = [] (const Point_2D& p,
+                          const Point_2D& q,
+                          const Point_2D& r)
+   {
+      const Real cross = (q.x - p.x) * (r.y - p.y) - (q.y - p.y) * (r.x - p.x);
+      return (cross > 0) - (cross < 0);
+   };
+
+   auto on_segment = [] (const Point_2D& p,
+                         const Point_2D& q,
+                         const Point_2D& r)
+   {
+      return std::min (p.x, q.x) <= r.x && r.x <= std::max (p.x, q.x) &&
+             std::min (p.y, q.y) <= r.y && r.y <= std::max (p.y, q.y);
+   };
+
+   const Integer o_1 = orientation (a, b, c);
+   const Integer o_2 = orientation (a, b, d);
+   const Integer o_3 = orientation (c, d, a);
+   const Integer o_4 = orientation (c, d, b);
+
+   if (o_1 != o_2 && o_3 != o_4) { return true; }
+   if (o_1 == 0 && on_segment (a, b, c)) { return true; }
+   if (o_2 == 0 && on_segment (a, b, d)) { return true; }
+   if (o_3 == 0 && on_segment (c, d, a)) { return true; }
+   if (o_4 == 0 && on_segment (c, d, b)) { return true; }
+   return false;
+
+}
+
+Cluster::Cluster ()
+   : id (next_cluster_id++),
+     version (0),
+     chain_simple (true),
+     simple (true),
+     histogram (1, 0.5),
+     total_wind (0, 0),
+     wind_weight (0),
+     mean_wind (GSL_NAN, GSL_NAN)
+{
+}
+
+Cluster::~Cluster ()
+{
+}
+
+void
+Cluster::add (const Point_2D& point)
+{
+
+   denise::Polygon::add (point);
+   vertices.push_back (point);
+   extent.extend (point);
+   version++;
+
+   // the new edge against the chain, then the closing edge against
+   // it; edges that share a vertex are skipped
+   const Integer n = vertices.size ();
+   const vector<Point_2D>& v = vertices;
+   for (Integer k = 0; chain_simple && k + 3 < n; k++)
+   {
+      if (meets (v[k], v[k + 1], v[n - 2], v[n - 1])) { chain_simple = false; }
+   }
+
+   simple = chain_simple;
+   for (Integer k = 1; simple && k + 2 < n; k++)
+   {
+      if (meets (v[k], v[k + 1], v[n - 1], v[0])) { simple = false; }
+   }
+
+}
+
+bool
+Cluster::is_analytic () const
+{
+   return false;
+}
+
+bool
+Cluster::contains_wind (const Real direction,
+                        const Real speed) const
+{
+   return false;
+}
+
+void
+Cluster::cairo (const RefPtr<Context>& cr) const
+{
+   denise::Polygon::cairo (cr);
+}
+
+Cluster*
+Cluster::clone () const
+{
+   return new Cluster (*this);
+}
+
+void
+Cluster::include (const Real temperature_925,
+                  const Wind& wind,
+                  const Real weight,
+                  const bool with_kde)
+{
+   moments.add (temperature_925, weight);
+   histogram.increment (temperature_925, weight);
+   if (with_kde) { kernel_density.increment (temperature_925, weight); }
+   total_wind = total_wind + wind * weight;
+   wind_weight += weight;
+   const Real n = wind_weight;
+   mean_wind = (n < 1e-9 ? Wind (GSL_NAN, GSL_NAN) : total_wind / n);
+}
+
+void
+Cluster::exclude (const Real temperature_925,
+                  const Wind& wind,
+                  const Real weight,
+                  const bool with_kde)
+{
+   moments.remove (temperature_925, weight);
+   histogram.decrement (temperature_925, weight);
+   if (with_kde) { kernel_density.decrement (temperature_925, weight); }
+   total_wind = total_wind - wind * weight;
+   wind_weight -= weight;
+   const Real n = wind_weight;
+   mean_wind = (n < 1e-9 ? Wind (GSL_NAN, GSL_NAN) : total_wind / n);
+}
+
+void
+Cluster::merge_tally (const Moments& moments,
+                      const Weighted_Histogram& histogram,
+                      const Kernel_Density* kernel_density_ptr,
+                      const Wind& total_wind,
+                      const Real wind_weight)
+{
+   this->moments.merge (moments);
+   this->histogram.merge (histogram);
+   if (kernel_density_ptr != nullptr)
+   {
+      this->kernel_density.merge (*kernel_density_ptr);
+   }
+   this->total_wind = this->total_wind + total_wind;
+   this->wind_weight += wind_weight;
+   const Real n = this->wind_weight;
+   mean_wind = (n < 1e-9 ? Wind (GSL_NAN, GSL_NAN) : this->total_wind / n);
+}
+
+void
+Cluster::clear_tally ()
+{
+   moments.clear ();
+   histogram.clear ();
+   kernel_density.clear ();
+   total_wind = Wind (0, 0);
+   wind_weight = 0;
+   mean_wind = Wind (GSL_NAN, GSL_NAN);
+}
+
+void
+Cluster::smooth ()
+{
+   kernel_density.smooth (Kernel_Density::get_bandwidth (moments));
+}
+
+Gaussian_Distribution
+Cluster::get_gaussian_distribution () const
+{
+   const Real mean = moments.get_mean ();
+   const Real variance = moments.get_variance ();
+   return Gaussian_Distribution (mean, variance);
+}
+
+Real
+Cluster::get_likelihood (const Real temperature_925,
+                         const Real n,
+                         const bool with_kde) const
+{
+   if (moments.n < 2) { return 0; }
+   const Gaussian_Distribution& gd = get_gaussian_distribution ();
+   const Real pdf = (with_kde ? kernel_density.get_density (temperature_925) :
+      gd.get_pdf (temperature_925));
+   const Real share = moments.n / n;
+   return pdf * share;
+}
+
+Sector_Cluster::Sector_Cluster (const Wind_Disc::Transform& transform,
+                                const Real start_direction,
+                                const Real end_direction,
+                                const Real start_speed,
+                                const Real end_speed,
+                                const Real outline_speed)
+   : start_direction (start_direction),
+     end_direction (end_direction),
+     start_speed (start_speed),
+     end_speed (end_speed)
+{
+
+   // the outline is only drawn, and used by get_index on canvas points
+   const Real width = std::min (end_direction - start_direction, 360.0);
+   const Integer n = std::max (Integer (ceil (width)), 2);
+   const Real outer_speed = std::min (end_speed, outline_speed);
+
+   for (Integer i = 0; i <= n; i++)
+   {
+      const Real direction = start_direction + i * width / n;
+      outer_arc.push_back (transform.transform (
+         Point_2D (direction, outer_speed)));
+      if (start_speed > 0)
+      {
+         inner_arc.push_back (transform.transform (
+            Point_2D (direction, start_speed)));
+      }
+   }
+
+   if (is_full_circle ()) { outer_arc.pop_back (); }
+   for (const Point_2D& p : outer_arc) { add (p); }
+
+   if (inner_arc.empty ())
+   {
+      if (!is_full_circle ())
+      {
+         add (transform.transform (Point_2D (start_direction, 0)));
+      }
+   }
+   else
+   {
+      // an annulus becomes a keyhole outline, the bridge cancels out
+      if (is_full_circle ()) { add (outer_arc.front ()); }
+      for (auto i = inner_arc.rbegin (); i != inner_arc.rend (); i++)
+      {
+         add (*i);
+      }
+   }
+
+}
+
+Cluster*
+Sector_Cluster::clone () const
+{
+   return new Sector_Cluster (*this);
+}
+
+bool
+Sector_Cluster::is_full_circle () const
+{
+   return (end_direction - start_direction >= 360);
+}
+
+bool
+Sector_Cluster::is_analytic () const
+{
+   return true;
+}
+
+bool
+Sector_Cluster::contains_wind (const Real direction,
+                               const Real speed) const
+{
+   if (!(speed >= start_speed && speed < end_speed)) { return false; }
+   if (is_full_circle ()) { return true; }
+   const Real d = fmod (direction - start_direction + 720, 360);
+   return (d < end_direction - start_direction);
+}
+
+void
+Sector_Cluster::cairo (const RefPtr<Context>& cr) const
+{
+
+   if (!is_full_circle ())
+   {
+      Cluster::cairo (cr);
+      return;
+   }
+
+   for (const vector<Point_2D>* arc_ptr : { &outer_arc, &inner_arc })
+   {
+      const vector<Point_2D>& arc = *arc_ptr;
+      if (arc.empty ()) { continue; }
+      cr->move_to (arc.front ().x, arc.front ().y);
+      for (const Point_2D& p : arc) { cr->line_to (p.x, p.y); }
+      cr->close_path ();
+   }
+
+}
+
+Clusters::Mask::Mask (const Real cell_size)
+   : cell_size (cell_size),
+     start_x (0),
+     start_y (0),
+     ni (0),
+     nj (0)
+{
+}
+
+void
+Clusters::Mask::fill (const Cluster& cluster,
+                      const Integer index,
+                      vector<Integer>& corner_tuple) const
+{
+
+   // even-odd scanline fill along each row of cell corners; outlines
+   // are simple here, so this agrees with contains whatever its rule
+   const vector<Point_2D>& vertices = cluster.vertices;
+   const Integer n = vertices.size ();
+   Tuple x_tuple;
+
+   for (Integer j = 0; j <= nj; j++)
+   {
+
+      const Real y = start_y + j * cell_size;
+      x_tuple.clear ();
+
+      for (Integer k = 0; k < n; k++)
+      {
+         const Point_2D& a = vertices[k];
+         const Point_2D& b = vertices[(k + 1) % n];
+         if ((a.y > y) == (b.y > y)) { continue; }
+         x_tuple.push_back (a.x + (y - a.y) * (b.x - a.x) / (b.y - a.y));
+      }
+
+      std::sort (x_tuple.begin (), x_tuple.end ());
+
+      for (Integer k = 0; k + 1 < x_tuple.size (); k += 2)
+      {
+         const Integer i_a = Integer (ceil ((x_tuple[k] - start_x) / cell_size));
+         const Integer i_b = Integer (floor ((x_tuple[k+1] - start_x) / cell_size));
+         for (Integer i = std::max (i_a, 0); i <= std::min (i_b, ni); i++)
+         {
+            Integer& corner = corner_tuple[j * (ni + 1) + i];
+            if (corner < 0) { corner = index; }
+         }
+      }
+
+   }
+
+}
+
+void
+Clusters::Mask::mark (const Point_2D& point_a,
+                      const Point_2D& point_b)
+{
+
+   // conservatively flag every cell the edge passes through
+   const Real epsilon = 1e-6;
+   Real ax = (point_a.x - start_x) / cell_size;
+   Real ay = (point_a.y - start_y) / cell_size;
+   Real bx = (point_b.x - start_x) / cell_size;
+   Real by = (point_b.y - start_y) / cell_size;
+   if (ax > bx) { std::swap (ax, bx); std::swap (ay, by); }
+
+   const Integer i_a = Integer (floor (ax - epsilon));
+   const Integer i_b = Integer (floor (bx + epsilon));
+
+   for (Integer i = std::max (i_a, 0); i <= std::min (i_b, ni - 1); i++)
+   {
+
+      const Real x_a = std::max (ax, Real (i));
+      const Real x_b = std::min (bx, Real (i + 1));
+      const bool vertical = (bx - ax < epsilon);
+      const Real dydx = (vertical ? 0 : (by - ay) / (bx - ax));
+      const Real y_a = (vertical ? ay : ay + (x_a - ax) * dydx);
+      const Real y_b = (vertical ? by : ay + (x_b - ax) * dydx);
+
+      const Integer j_a = Integer (floor (std::min (y_a, y_b) - epsilon));
+      const Integer j_b = Integer (floor (std::max (y_a, y_b) + epsilon));
+
+      for (Integer j = std::max (j_a, 0); j <= std::min (j_b, nj - 1); j++)
+      {
+         cell_tuple[j * ni + i] = boundary;
+      }
+
+   }
+
+}
+
+bool
+Clusters::Mask::is_current (const Clusters& clusters) const
+{
+
+   if (id_tuple.size () != clusters.size ()) { return false; }
+
+   for (Integer i = 0; i < clusters.size (); i++)
+   {
+      const Cluster* cluster_ptr = clusters.at (i);
+      const bool rasterized = clusters.is_rasterized (i);
+      const Integer version = (rasterized ? cluster_ptr->version : -1);
+      if (id_tuple[i] != cluster_ptr->id) { return false; }
+      if (version_tuple[i] != version) { return false; }
+   }
+
+   return true;
+
+}
+
+void
+Clusters::Mask::build (const Clusters& clusters)
+{
+
+   id_tuple.clear ();
+   version_tuple.clear ();
+   index_tuple.clear ();
+
+   Extent extent;
+
+   for (Integer i = 0; i < clusters.size (); i++)
+   {
+      const Cluster* cluster_ptr = clusters.at (i);
+      const bool rasterized = clusters.is_rasterized (i);
+      id_tuple.push_back (cluster_ptr->id);
+      version_tuple.push_back (rasterized ? cluster_ptr->version : -1);
+      if (!rasterized) { continue; }
+      index_tuple.push_back (i);
+      extent.extend (cluster_ptr->extent);
+   }
+
+   if (extent.is_empty ())
+   {
+      ni = nj = 0;
+      cell_tuple.clear ();
+      return;
+   }
+
+   start_x = extent.start_x - cell_size;
+   start_y = extent.start_y - cell_size;
+   ni = Integer (ceil ((extent.end_x - start_x) / cell_size)) + 1;
+   nj = Integer (ceil ((extent.end_y - start_y) / cell_size)) + 1;
+
+   vector<Integer> corner_tuple ((ni + 1) * (nj + 1), -1);
+   for (const Integer i : index_tuple)
+   {
+      fill (clusters.get_cluster (i), i, corner_tuple);
+   }
+
+   // a cell is uniform when its corners agree and no outline crosses it
+   cell_tuple.assign (ni * nj, -1);
+   for (Integer j = 0; j < nj; j++)
+   {
+      for (Integer i = 0; i < ni; i++)
+      {
+         const Integer c = corner_tuple[j * (ni + 1) + i];
+         const bool uniform =
+            (c == corner_tuple[j * (ni + 1) + i + 1]) &&
+            (c == corner_tuple[(j + 1) * (ni + 1) + i]) &&
+            (c == corner_tuple[(j + 1) * (ni + 1) + i + 1]);
+         cell_tuple[j * ni + i] = c;
+         if (!uniform) { cell_tuple[j * ni + i] = boundary; }
+      }
+   }
+
+   for (const Integer i : index_tuple)
+   {
+      const vector<Point_2D>& vertices = clusters.get_cluster (i).vertices;
+      const Integer n = vertices.size ();
+      for (Integer k = 0; k < n; k++)
+      {
+         mark (vertices[k], vertices[(k + 1) % n]);
+      }
+   }
+
+}
+
+Integer
+Clusters::Mask::get_index (const Point_2D& point,
+                           const Clusters& clusters) const
+{
+
+   const Real x = (point.x - start_x) / cell_size;
+   const Real y = (point.y - start_y) / cell_size;
+   if (!(x >= 0 && y >= 0 && x < ni && y < nj)) { return -1; }
+
+   const Integer c = cell_tuple[Integer (y) * ni + Integer (x)];
+   if (c != boundary) { return c; }
+
+   for (const Integer i : index_tuple)
+   {
+      if (clusters.get_cluster (i).contains (point)) { return i; }
+   }
+
+   return -1;
+
+}
+
+bool
+Clusters::is_analysed (const Record::Columns& columns) const
+{
+
+   if (&columns != columns_ptr) { return false; }
+   if (with_kde != analysed_with_kde) { return false; }
+   if (analysed_id_tuple.size () != size ()) { return false; }
+
+   for (Integer i = 0; i < size (); i++)
+   {
+      const Cluster* cluster_ptr = at (i);
+      if (analysed_id_tuple[i] != cluster_ptr->id) { return false; }
+      if (analysed_version_tuple[i] != cluster_ptr->version) { return false; }
+   }
+
+   return true;
+
+}
+
+Cluster&
+Clusters::get_tally (const Integer index)
+{
+   return (index < 0 ? rest : get_cluster (index));
+}
+
+void
+Clusters::assign (const Record::Columns& columns,
+                  const Record::Projection& projection,
+                  Wind_Rose* wind_rose_ptr,
+                  Histogram_1D* histogram_ptr)
+{
+
+   reset ();
+   this->columns_ptr = &columns;
+   this->projection_ptr = &projection;
+
+   const Integer n = columns.size ();
+   index_tuple.resize (n);
+
+   // the wind rose and overall histogram are only asked for once per
+   // analog set and only count, so they are fed here on this thread;
+   // weighted analogs count once they carry at least half a weight
+   if (wind_rose_ptr != nullptr || histogram_ptr != nullptr)
+   {
+      for (Integer k = 0; k < n; k++)
+      {
+         if (columns.weight_tuple[k] < 0.5) { continue; }
+         const Wind& wind = columns.wind_tuple[k];
+         const Real temperature_925 = columns.temperature_925_tuple[k];
+         if (wind_rose_ptr != nullptr) { wind_rose_ptr->add_wind (wind); }
+         if (histogram_ptr != nullptr) { histogram_ptr->increment (temperature_925); }
+      }
+   }
+
+   // chunks are classified and tallied on worker threads, then merged in
+   // chunk order so the moments do not depend on the number of threads
+   const Chunks chunks (n);
+   vector<Partial> partial_tuple (chunks.size (), Partial (size (), with_kde));
+
+   chunks.run ([&] (const Integer c)
+   {
+
+      Partial& partial = partial_tuple[c];
+
+      for (Integer k = chunks.get_start (c); k < chunks.get_end (c); k++)
+      {
+
+         const Wind& wind = columns.wind_tuple[k];
+         const Real temperature_925 = columns.temperature_925_tuple[k];
+         const Real weight = columns.weight_tuple[k];
+         partial.moments.add (temperature_925, weight);
+
+         // records without a wind are kept out of every tally
+         if (wind.is_naw ())
+         {
+            index_tuple[k] = -2;
+            continue;
+         }
+
+         const Real direction = columns.direction_tuple[k];
+         const Real speed = columns.speed_tuple[k];
+         const Point_2D& point = projection.point_tuple[k];
+         const Integer i = get_index (point, direction, speed);
+         index_tuple[k] = i;
+         partial.include (i, temperature_925, wind, weight);
+
+      }
+
+   });
+
+   for (const Partial& partial : partial_tuple)
+   {
+      moments.merge (partial.moments);
+      for (Integer i = -1; i < Integer (size ()); i++)
+      {
+         const Integer slot = i + 1;
+         const Kernel_Density* kernel_density_ptr = (partial.with_kde ?
+            &partial.kernel_density_tuple[slot] : nullptr);
+         get_tally (i).merge_tally (partial.moments_tuple[slot],
+            partial.histogram_tuple[slot], kernel_density_ptr,
+            partial.total_wind_tuple[slot], partial.wind_weight_tuple[slot]);
+      }
+   }
+
+}
+
+void
+Clusters::reassign ()
+{
+
+   if (dirty_extent.is_empty ()) { return; }
+   const Record::Columns& columns = *columns_ptr;
+   const vector<Point_2D>& point_tuple = projection_ptr->point_tuple;
+
+   for (Integer k = 0; k < point_tuple.size (); k++)
+   {
+
+      const Point_2D& point = point_tuple[k];
+      if (index_tuple[k] < -1) { continue; }
+      if (!dirty_extent.contains (point)) { continue; }
+
+      const Real direction = columns.direction_tuple[k];
+      const Real speed = columns.speed_tuple[k];
+      const Integer i = get_index (point, direction, speed);
+      Integer& index = index_tuple[k];
+      if (i == index) { continue; }
+
+      const Wind& wind = columns.wind_tuple[k];
+      const Real temperature_925 = columns.temperature_925_tuple[k];
+      const Real weight = columns.weight_tuple[k];
+      get_tally (index).exclude (temperature_925, wind, weight, with_kde);
+      get_tally (i).include (temperature_925, wind, weight, with_kde);
+      index = i;
+
+   }
+
+   dirty_extent = Extent ();
+
+}
+
+Clusters::Partial::Partial (const Integer number_of_clusters,
+                            const bool with_kde)
+   : moments_tuple (number_of_clusters + 1),
+     histogram_tuple (number_of_clusters + 1, Weighted_Histogram (1, 0.5)),
+     with_kde (with_kde),
+     kernel_density_tuple (with_kde ? number_of_clusters + 1 : 0),
+     total_wind_tuple (number_of_clusters + 1, Wind (0, 0)),
+     wind_weight_tuple (number_of_clusters + 1, 0)
+{
+}
+
+void
+Clusters::Partial::include (const Integer index,
+                            const Real temperature_925,
+                            const Wind& wind,
+                            const Real weight)
+{
+   const Integer slot = std::max (index, -1) + 1;
+   moments_tuple[slot].add (temperature_925, weight);
+   histogram_tuple[slot].increment (temperature_925, weight);
+   if (with_kde) { kernel_density_tuple[slot].increment (temperature_925, weight); }
+   total_wind_tuple[slot] = total_wind_tuple[slot] + wind * weight;
+   wind_weight_tuple[slot] += weight;
+}
+
+Clusters::Clusters ()
+   : columns_ptr (nullptr),
+     projection_ptr (nullptr),
+     analysed_with_kde (false),
+     defining (-1),
+     with_kde (false)
+{
+}
+
+Clusters::~Clusters ()
+{
+   clear ();
+}
+
+Clusters*
+Clusters::clone () const
+{
+   Clusters* clusters_ptr = new Clusters ();
+   for (const Cluster* cluster_ptr : *this)
+   {
+      clusters_ptr->push_back (cluster_ptr->clone ());
+   }
+   clusters_ptr->defining = defining;
+   clusters_ptr->with_kde = with_kde;
+   return clusters_ptr;
+}
+
+bool
+Clusters::is_defining () const
+{
+   return (defining >= 0);
+}
+
+bool
+Clusters::is_rasterized (const Integer index) const
+{
+   // the outline being drawn changes on every motion event, and a
+   // crossed outline is left to contains, whose fill rule may differ
+   const Cluster& cluster = get_cluster (index);
+   if (cluster.is_analytic () || !cluster.simple) { return false; }
+   return (index != defining) && (cluster.vertices.size () > 2);
+}
+
+void
+Clusters::refresh_mask ()
+{
+   if (!mask.is_current (*this)) { mask.build (*this); }
+}
+
+Integer
+Clusters::get_index (const Point_2D& point) const
+{
+   return get_index (point, GSL_NAN, GSL_NAN);
+}
+
+Integer
+Clusters::get_index (const Point_2D& point,
+                     const Real direction,
+                     const Real speed) const
+{
+
+   Integer index = -1;
+
+   if (mask.is_current (*this))
+   {
+      index = mask.get_index (point, *this);
+   }
+   else
+   {
+      for (Integer i = 0; i < size (); i++)
+      {
+         const Cluster& cluster = get_cluster (i);
+         if (cluster.is_analytic ()) { continue; }
+         if (cluster.contains (point)) { index = i; break; }
+      }
+   }
+
+   // analytic shapes, crossed outlines and the outline being drawn are
+   // not rasterized; without a wind, analytic shapes fall back to their
+   // outline
+   const bool by_outline = gsl_isnan (speed);
+   const Integer n = (index < 0 ? size () : index);
+
+   for (Integer i = 0; i < n; i++)
+   {
+      const Cluster& cluster = get_cluster (i);
+      if (cluster.is_analytic ())
+      {
+         const bool b = (by_outline ? cluster.contains (point) :
+            cluster.contains_wind (direction, speed));
+         if (b) { return i; }
+      }
+      else
+      if (!is_rasterized (i))
+      {
+         if (cluster.contains (point)) { return i; }
+      }
+   }
+
+   return index;
+
+}
+
+Cluster&
+Clusters::get_cluster (const Integer index)
+{
+   return *at (index);
+}
+
+const Cluster&
+Clusters::get_cluster (const Integer index) const
+{
+   return *at (index);
+}
+
+Cluster&
+Clusters::get_cluster (const Point_2D& point)
+{
+   const Integer i = get_index (point);
+   if (i < 0) { throw Exception ("No matching cluster."); }
+   return get_cluster (i);
+}
+
+const Cluster&
+Clusters::get_cluster (const Point_2D& point) const
+{
+   const Integer i = get_index (point);
+   if (i < 0) { throw Exception ("No matching cluster."); }
+   return get_cluster (i);
+}
+
+Cluster&
+Clusters::get_defining_cluster ()
+{
+   return *at (defining);
+}
+
+const Cluster&
+Clusters::get_defining_cluster (const Integer index) const
+{
+   return *at (defining);
+}
+
+void
+Clusters::add (const Point_2D& point,
+               const Integer index)
+{
+
+   this->defining = (index < 0 ? size () : index);
+   Cluster& cluster = get_cluster (defining);
+
+   const bool tracked = (defining < analysed_id_tuple.size ()) &&
+      (analysed_id_tuple[defining] == cluster.id) &&
+      (analysed_version_tuple[defining] == cluster.version);
+
+   // appending a vertex only changes membership within the triangle
+   // spanned by the first vertex, the last vertex and the new one
+   if (tracked && !cluster.vertices.empty ())
+   {
+      dirty_extent.extend (cluster.vertices.front ());
+      dirty_extent.extend (cluster.vertices.back ());
+      dirty_extent.extend (point);
+   }
+
+   cluster.add (point);
+   if (tracked) { analysed_version_tuple[defining] = cluster.version; }
+
+}
+
+void
+Clusters::remove (const Integer index)
+{
+   const Integer i = (index < 0 ? defining : index);
+   if (i < 0 || i > size () - 1) { return; }
+   erase (begin () + i);
+   if (i == defining) { defining = -1; }
+}
+
+void
+Clusters::clear ()
+{
+   for (Cluster* cluster_ptr : *this) { delete cluster_ptr; }
+   vector<Cluster*>::clear ();
+   defining = -1;
    reset ();
+}
+
+void
+Clusters::reset ()
+{
+
+   for (Cluster* cluster_ptr : *this) { cluster_ptr->clear_tally (); }
+   rest.clear_tally ();
+   moments.clear ();
+
+   columns_ptr = nullptr;
+   projection_ptr = nullptr;
+   index_tuple.clear ();
+   analysed_id_tuple.clear ();
+   analysed_version_tuple.clear ();
+   dirty_extent = Extent ();
+
+}
+
+const vector<Integer>&
+Clusters::get_index_tuple () const
+{
+   return index_tuple;
+}
+
+const Moments&
+Clusters::get_moments () const
+{
+   return moments;
+}
+
+const Cluster&
+Clusters::get_rest () const
+{
+   return rest;
+}
+
+void
+Clusters::render (const RefPtr<Context>& cr,
+                  const Real alpha) const
+{
+
+   cr->save ();
+   cr->set_line_width (6);
+   Dashes ("2:10").cairo (cr);
+
+   for (Integer i = 0; i < size (); i++)
+   {
+      Color (i, alpha).cairo (cr);
+      at (i)->cairo (cr);
+      cr->stroke ();
+   }
+
+   cr->restore ();
+
+}
+
+void
+Clusters::render_defining (const RefPtr<Context>& cr) const
+{
+
+   if (defining < 0) { return; }
+
+   cr->save ();
+   cr->set_line_width (6);
+   Dashes ("2:10").cairo (cr);
+
+   const Cluster& cluster = get_cluster (defining);
+   Color (defining).cairo (cr);
+   cluster.cairo (cr);
+   cr->stroke ();
+
+   cr->restore ();
+
+}
+
+void
+Clusters::cluster_analysis (const Record::Columns& columns,
+                            const Record::Projection& projection,
+                            const Predictor& predictor,
+                            Wind_Rose* wind_rose_ptr,
+                            Histogram_1D* histogram_ptr)
+{
+
+   refresh_mask ();
+
+   // a request for the analog-set summaries always takes the full pass
+   const bool summarize = (wind_rose_ptr != nullptr || histogram_ptr != nullptr);
+
+   if (!summarize && is_analysed (columns))
+   {
+      // only the outline being drawn can have moved since last time
+      reassign ();
+   }
+   else
+   {
+      assign (columns, projection, wind_rose_ptr, histogram_ptr);
+      analysed_with_kde = with_kde;
+      for (const Cluster* cluster_ptr : *this)
+      {
+         analysed_id_tuple.push_back (cluster_ptr->id);
+         analysed_version_tuple.push_back (cluster_ptr->version);
+      }
+   }
+
+   // smoothing is skipped for the tallies that have not changed
+   if (with_kde)
+   {
+      rest.smooth ();
+      for (Cluster* cluster_ptr : *this) { cluster_ptr->smooth (); }
+   }
+
+   const Real n = columns.get_total_weight ();
+   const Real t = predictor.temperature_925;
+   Real denominator = rest.get_likelihood (t, n, with_kde);
+
+   for (Integer j = 0; j < size (); j++)
+   {
+      const Cluster& cluster = *(at (j));
+      denominator += cluster.get_likelihood (t, n, with_kde);
+   }
+
+   for (Integer i = 0; i < size (); i++)
+   {
+      Cluster& cluster = *(at (i));
+      cluster.probability = cluster.get_likelihood (t, n, with_kde) / denominator;
+   }
+
+}
+
+Bootstrap::Sample::Sample (const Clusters& clusters,
+                           const Record::Columns& columns,
+                           const Real temperature_925,
+                           const bool with_kde)
+   : temperature_925 (temperature_925),
+     with_kde (with_kde),
+     number_of_clusters (clusters.size ()),
+     weight_tuple (columns.weight_tuple),
+     temperature_925_tuple (columns.temperature_925_tuple)
+{
+
+   const vector<Integer>& index_tuple = clusters.get_index_tuple ();
+   for (Integer k = 0; k < columns.size (); k++)
+   {
+      const Integer i = index_tuple[k];
+      slot_tuple.push_back (i < -1 ? -1 : i + 1);
+   }
+
+   // the kernel densities keep the bandwidths of the full analog set and
+   // are summed at the predictor temperature only
+   const Moments& rest_moments = clusters.get_rest ().moments;
+   bandwidth_tuple.push_back (Kernel_Density::get_bandwidth (rest_moments));
+   for (const Cluster* cluster_ptr : clusters)
+   {
+      const Moments& moments = cluster_ptr->moments;
+      bandwidth_tuple.push_back (Kernel_Density::get_bandwidth (moments));
+   }
+
+}
+
+Bootstrap::Bootstrap ()
+   : number_of_replicates (0)
+{
+}
+
+void
+Bootstrap::clear ()
+{
+   number_of_replicates = 0;
+   lower_tuple.clear ();
+   upper_tuple.clear ();
+}
+
+bool
+Bootstrap::run (const Sample& sample,
+                const function<bool ()>& is_cancelled,
+                const Integer max_replicates)
+{
+
+   clear ();
+
+   const Real temperature_925 = sample.temperature_925;
+   const bool with_kde = sample.with_kde;
+   const vector<Integer>& slot_tuple = sample.slot_tuple;
+   const Tuple& bandwidth_tuple = sample.bandwidth_tuple;
+   const Integer n = slot_tuple.size ();
+   const Integer nc = sample.number_of_clusters;
+   const Integer ns = nc + 1;
+   if (n < 2 || nc == 0 || gsl_isnan (temperature_925)) { return true; }
+
+   // big analog sets get fewer replicates rather than a longer wait; the
+   // count depends on n alone, so the same inputs give the same intervals
+   const Integer draws = 40000000;
+   const Integer nr = std::max (std::min (max_replicates, draws / n), 100);
+   vector<Tuple> probability_tuple (nr);
+   const Chunks chunks (nr, 8);
+
+   chunks.run ([&] (const Integer c)
+   {
+
+      if (is_cancelled ()) { return; }
+      vector<Moments> moments_tuple (ns);
+      vector<Real> kernel_sum_tuple (ns);
+      vector<Real> likelihood_tuple (ns, 0);
 
-   Cluster cluster_rest;
+      for (Integer r = chunks.get_start (c); r < chunks.get_end (c); r++)
+      {
+
+         // each replicate has its own seed, whatever thread runs it
+         mt19937_64 engine (r * 0x9e3779b97f4a7c15ULL + 925);
+         uniform_int_distribution<Integer> uniform (0, n - 1);
+         for (Moments& moments : moments_tuple) { moments.clear (); }
+         fill (kernel_sum_tuple.begin (), kernel_sum_tuple.end (), 0);
+         Real total_weight = 0;
+
+         for (Integer draw = 0; draw < n; draw++)
+         {
+            const Integer k = uniform (engine);
+            const Integer slot = slot_tuple[k];
+            const Real weight = sample.weight_tuple[k];
+            total_weight += weight;
+            if (slot < 0) { continue; }
+            const Real temperature = sample.temperature_925_tuple[k];
+            moments_tuple[slot].add (temperature, weight);
+            if (!with_kde || gsl_isnan (temperature)) { continue; }
+            const Real z = (temperature_925 - temperature) / bandwidth_tuple[slot];
+            kernel_sum_tuple[slot] += weight * exp (-0.5 * z * z);
+         }
+
+         Real denominator = 0;
+         for (Integer slot = 0; slot < ns; slot++)
+         {
+            const Moments& moments = moments_tuple[slot];
+            Real& likelihood = likelihood_tuple[slot];
+            likelihood = 0;
+            if (moments.n < 2) { continue; }
+            const Real mean = moments.get_mean ();
+            const Real variance = moments.get_variance ();
+
+            // a few repeats of one record give no spread to fit
+            if (!(variance > 0)) { continue; }
+
+            if (with_kde)
+            {
+               const Real h = bandwidth_tuple[slot];
+               if (!(h > 0)) { continue; }
+               const Real a = sqrt (2 * M_PI) * h * total_weight;
+               likelihood = kernel_sum_tuple[slot] / a;
+            }
+            else
+            {
+               const Gaussian_Distribution gd (mean, variance);
+               const Real share = moments.n / total_weight;
+               likelihood = gd.get_pdf (temperature_925) * share;
+            }
+
+            denominator += likelihood;
+         }
 
-   // fill clusters and cluster_rest
-   for (const Record& record : record_set)
+         if (!(denominator > 0)) { continue; }
+         Tuple& probability = probability_tuple[r];
+         for (Integer i = 0; i < nc; i++)
+         {
+            probability.push_back (likelihood_tuple[i + 1] / denominator);
+         }
+
+      }
+
+   });
+
+   if (is_cancelled ()) { return false; }
+
+   for (const Tuple& probability : probability_tuple)
    {
+      if (!probability.empty ()) { number_of_replicates++; }
+   }
 
-      const Wind& wind = record.wind;
-      const Real multiplier = 0.51444444;
-      const Real speed = wind.get_speed () / multiplier;
+   // linear interpolation between order statistics
+   auto get_quantile = [] (const Tuple& sorted, const Real q)
+   {
+      const Real x = q * (sorted.size () - 1);
+      const Integer i = Integer (floor (x));
+      const Integer j = std::min (i + 1, Integer (sorted.size () - 1));
+      return sorted[i] + (x - i) * (sorted[j] - sorted[i]);
+   };
 
-      if (wind.is_naw ()) { continue; }
+   for (Integer i = 0; i < nc; i++)
+   {
 
-      const Integer i = get_index (
-         transform.transform (Point_2D (wind.get_direction (), speed)));
+      Tuple sorted;
+      for (const Tuple& probability : probability_tuple)
+      {
+         if (probability.empty ()) { continue; }
+         sorted.push_back (probability[i]);
+      }
 
-      if (i < 0)
+      if (sorted.empty ())
       {
-         cluster_rest.histogram.increment (record.temperature_925);
-         cluster_rest.tuple.push_back (record.temperature_925);
+         lower_tuple.push_back (GSL_NAN);
+         upper_tuple.push_back (GSL_NAN);
+         continue;
       }
-      else
+
+      sort (sorted.begin (), sorted.end ());
+      lower_tuple.push_back (get_quantile (sorted, 0.05));
+      upper_tuple.push_back (get_quantile (sorted, 0.95));
+
+   }
+
+   return true;
+
+}
+
+void
+Sensitivity::clear ()
+{
+   threshold_tuple.clear ();
+   probability_tuples.clear ();
+}
+
+Sensitivity::Candidates::Candidates (const Clusters& clusters,
+                                    const Record::Columns& columns,
+                                    const Transform_2D& transform,
+                                    const Tuple& distance_tuple)
+   : number_of_clusters (clusters.size ()),
+     temperature_925_tuple (columns.temperature_925_tuple),
+     weight_tuple (columns.weight_tuple),
+     distance_tuple (distance_tuple)
+{
+
+   // slot 0 is the rest, slot i + 1 is cluster i, -1 has no wind
+   for (Integer k = 0; k < columns.size (); k++)
+   {
+      if (columns.wind_tuple[k].is_naw ()) { slot_tuple.push_back (-1); continue; }
+      const Real direction = columns.direction_tuple[k];
+      const Real speed = columns.speed_tuple[k];
+      const Point_2D& point = transform.transform (Point_2D (direction, speed));
+      slot_tuple.push_back (clusters.get_index (point, direction, speed) + 1);
+   }
+
+}
+
+bool
+Sensitivity::sweep (const Candidates& candidates,
+                    const Tuple& threshold_tuple,
+                    const bool inclusive,
+                    const Real temperature_925,
+                    const function<bool ()>& is_cancelled)
+{
+
+   clear ();
+   this->threshold_tuple = threshold_tuple;
+
+   const Tuple& distance_tuple = candidates.distance_tuple;
+   const vector<Integer>& slot_tuple = candidates.slot_tuple;
+   const Integer n = slot_tuple.size ();
+   const Integer nc = candidates.number_of_clusters;
+   const Integer ns = nc + 1;
+   probability_tuples.assign (nc, Tuple ());
+
+   vector<Integer> order_tuple (n);
+   for (Integer k = 0; k < n; k++) { order_tuple[k] = k; }
+   stable_sort (order_tuple.begin (), order_tuple.end (),
+      [&] (const Integer a, const Integer b)
+      { return distance_tuple[a] < distance_tuple[b]; });
+
+   vector<Moments> moments_tuple (ns);
+   Real total_weight = 0;
+   Integer p = 0;
+
+   for (const Real threshold : threshold_tuple)
+   {
+
+      if (is_cancelled ()) { return false; }
+
+      // the prefix of the sorted candidates is the analog set
+      for (; p < n; p++)
+      {
+         const Integer k = order_tuple[p];
+         const Real distance = distance_tuple[k];
+         if (inclusive ? (distance > threshold) : (distance >= threshold)) { break; }
+         const Real weight = candidates.weight_tuple[k];
+         total_weight += weight;
+         const Integer slot = slot_tuple[k];
+         if (slot < 0) { continue; }
+         moments_tuple[slot].add (candidates.temperature_925_tuple[k], weight);
+      }
+
+      Tuple likelihood_tuple;
+      Real denominator = 0;
+      for (const Moments& moments : moments_tuple)
+      {
+         Real likelihood = 0;
+         if (moments.n >= 2)
+         {
+            const Real mean = moments.get_mean ();
+            const Real variance = moments.get_variance ();
+            const Gaussian_Distribution gd (mean, variance);
+            likelihood = gd.get_pdf (temperature_925) * moments.n / total_weight;
+         }
+         likelihood_tuple.push_back (likelihood);
+         denominator += likelihood;
+      }
+
+      for (Integer i = 0; i < nc; i++)
       {
-         Cluster& cluster = *(at (i));
-         const Integer n = cluster.tuple.size ();
-         cluster.histogram.increment (record.temperature_925);
-         cluster.tuple.push_back (record.temperature_925);
-         if (n == 0) { cluster.mean_wind = wind; }
-         else { cluster.mean_wind = ((cluster.mean_wind * n) + wind) / (n+1); }
+         const Real likelihood = likelihood_tuple[i + 1];
+         probability_tuples[i].push_back (likelihood / denominator);
       }
 
    }
 
-   const Integer n = record_set.size ();
-   Real denominator = cluster_rest.get_likelihood (predictor.temperature_925, n);
+   return true;
 
-   for (Integer j = 0; j < size (); j++)
+}
+
+void
+Sensitivity::render (const RefPtr<Context>& cr,
+                     const Box_2D& box_2d,
+                     const Real threshold,
+                     const Dstring& title) const
+{
+
+   if (threshold_tuple.size () < 2) { return; }
+
+   const Domain_1D domain_x (threshold_tuple.front (), threshold_tuple.back ());
+   const Domain_1D domain_y (100, 0);
+   const Cartesian_Transform_2D transform (domain_x, domain_y, box_2d);
+   const Point_2D nw = box_2d.get_nw ();
+   const Real width = box_2d.size_2d.i;
+   const Real height = box_2d.size_2d.j;
+
+   cr->save ();
+
+   Color::white (0.4).cairo (cr);
+   Rect (nw, width, height).cairo (cr);
+   cr->fill ();
+
+   cr->set_line_width (2);
+   for (Integer i = 0; i < probability_tuples.size (); i++)
    {
-      const Cluster& cluster = *(at (j));
-      denominator += cluster.get_likelihood (predictor.temperature_925, n);
+      const Tuple& probability_tuple = probability_tuples[i];
+      bool drawing = false;
+      for (Integer s = 0; s < threshold_tuple.size (); s++)
+      {
+         const Real p = probability_tuple[s] * 100;
+         if (gsl_isnan (p)) { drawing = false; continue; }
+         const Point_2D& point = transform.transform (
+            Point_2D (threshold_tuple[s], p));
+         if (drawing) { cr->line_to (point.x, point.y); }
+         else { cr->move_to (point.x, point.y); }
+         drawing = true;
+      }
+      Color (i, 0.8).cairo (cr);
+      cr->stroke ();
    }
 
-   for (Integer i = 0; i < size (); i++)
+   // where the current threshold sits
+   const Real x = bound (threshold, domain_x.end, domain_x.start);
+   const Point_2D& top = transform.transform (Point_2D (x, 100));
+   const Point_2D& bottom = transform.transform (Point_2D (x, 0));
+   cr->set_line_width (1);
+   Color::black (0.6).cairo (cr);
+   Edge (top, bottom).cairo (cr);
+   cr->stroke ();
+
+   cr->set_font_size (10);
+   Color::black (0.8).cairo (cr);
+   Label (title, nw + Point_2D (4, 4), 'l', 't').cairo (cr);
+
+   cr->restore ();
+
+}
+
+Response_Surface::Candidates::Candidates (const Clusters& clusters,
+                                         const Record::Columns& columns,
+                                         const Transform_2D& transform)
+   : number_of_clusters (clusters.size ())
+{
+
+   for (Integer k = 0; k < columns.size (); k++)
    {
-      Cluster& cluster = *(at (i));
-      cluster.probability =
-         cluster.get_likelihood (predictor.temperature_925, n) / denominator;
+
+      const Real theta = columns.direction_925_tuple[k] * M_PI / 180;
+      const Real speed_925 = columns.speed_925_tuple[k];
+      u_925_tuple.push_back (-speed_925 * sin (theta));
+      v_925_tuple.push_back (-speed_925 * cos (theta));
+      temperature_925_tuple.push_back (columns.temperature_925_tuple[k]);
+
+      // slot 0 is the rest, slot i + 1 is cluster i, -1 has no wind
+      if (columns.wind_tuple[k].is_naw ()) { slot_tuple.push_back (-1); continue; }
+      const Real direction = columns.direction_tuple[k];
+      const Real speed = columns.speed_tuple[k];
+      const Point_2D& point = transform.transform (Point_2D (direction, speed));
+      slot_tuple.push_back (clusters.get_index (point, direction, speed) + 1);
+
+   }
+
+}
+
+Response_Surface::Response_Surface (const Real extent,
+                                    const Real delta)
+   : extent (extent),
+     delta (delta),
+     n (Integer (round (2 * extent / delta)) + 1)
+{
+}
+
+bool
+Response_Surface::compute (const Candidates& candidates,
+                           const Real threshold,
+                           const Real temperature_925,
+                           const function<bool ()>& is_cancelled)
+{
+
+   const Integer nc = candidates.number_of_clusters;
+   const Integer ns = nc + 1;
+   const Integer nn = candidates.slot_tuple.size ();
+   const Real threshold_2 = threshold * threshold;
+   probability_tuples.assign (nc, Tuple ());
+   for (Tuple& tuple : probability_tuples) { tuple.resize (n * n, GSL_NAN); }
+
+   // each node is the analog query at that predictor wind
+   const Chunks chunks (n * n, 16);
+   chunks.run ([&] (const Integer c)
+   {
+
+      if (is_cancelled ()) { return; }
+      vector<Moments> moments_tuple (ns);
+
+      for (Integer node = chunks.get_start (c); node < chunks.get_end (c); node++)
+      {
+
+         const Real u = -extent + (node / n) * delta;
+         const Real v = -extent + (node % n) * delta;
+         for (Moments& moments : moments_tuple) { moments.clear (); }
+         Real total = 0;
+
+         for (Integer k = 0; k < nn; k++)
+         {
+            const Real du = candidates.u_925_tuple[k] - u;
+            const Real dv = candidates.v_925_tuple[k] - v;
+            if (!(du * du + dv * dv < threshold_2)) { continue; }
+            total += 1;
+            const Integer slot = candidates.slot_tuple[k];
+            if (slot < 0) { continue; }
+            moments_tuple[slot].add (candidates.temperature_925_tuple[k]);
+         }
+
+         Real denominator = 0;
+         vector<Real> likelihood_tuple (ns, 0);
+         for (Integer slot = 0; slot < ns; slot++)
+         {
+            const Moments& moments = moments_tuple[slot];
+            if (moments.n < 2) { continue; }
+            const Real mean = moments.get_mean ();
+            const Real variance = moments.get_variance ();
+            const Gaussian_Distribution gd (mean, variance);
+            likelihood_tuple[slot] = gd.get_pdf (temperature_925) * moments.n / total;
+            denominator += likelihood_tuple[slot];
+         }
+
+         for (Integer i = 0; i < nc; i++)
+         {
+            probability_tuples[i][node] = likelihood_tuple[i + 1] / denominator;
+         }
+
+      }
+
+   });
+
+   return !is_cancelled ();
+
+}
+
+Real
+Response_Surface::get_probability (const Integer cluster_index,
+                                   const Wind& wind_925) const
+{
+
+   if (cluster_index < 0 || cluster_index >= probability_tuples.size ())
+   {
+      return GSL_NAN;
+   }
+
+   const Real multiplier = 0.51444444;
+   const Real theta = wind_925.get_direction () * M_PI / 180;
+   const Real speed = wind_925.get_speed () / multiplier;
+   const Real e = 1e-9;
+   const Real x = (-speed * sin (theta) + extent) / delta;
+   const Real y = (-speed * cos (theta) + extent) / delta;
+   if (!(x > -e && x < n - 1 + e && y > -e && y < n - 1 + e)) { return GSL_NAN; }
+
+   // bilinear between the four nodes around the wind
+   const Integer i = std::min (std::max (Integer (floor (x)), Integer (0)), n - 2);
+   const Integer j = std::min (std::max (Integer (floor (y)), Integer (0)), n - 2);
+   const Real fx = x - i;
+   const Real fy = y - j;
+   const Tuple& p = probability_tuples[cluster_index];
+
+   // nodes without analogs are left out rather than spoiling the cell
+   Real sum = 0, weight_sum = 0;
+   const Real weight[4] = { (1 - fx) * (1 - fy), (1 - fx) * fy,
+      fx * (1 - fy), fx * fy };
+   const Real value[4] = { p[i * n + j], p[i * n + j + 1],
+      p[(i + 1) * n + j], p[(i + 1) * n + j + 1] };
+   for (Integer k = 0; k < 4; k++)
+   {
+      if (!(weight[k] > 0) || gsl_isnan (value[k])) { continue; }
+      sum += weight[k] * value[k];
+      weight_sum += weight[k];
+   }
+
+   return (weight_sum > 0 ? sum / weight_sum : GSL_NAN);
+
+}
+
+void
+Response_Surface::render (const RefPtr<Context>& cr,
+                          const Transform_2D& transform,
+                          const Tuple& level_tuple) const
+{
+
+   auto get_point = [&] (const Real x, const Real y)
+   {
+      const Real u = -extent + x * delta;
+      const Real v = -extent + y * delta;
+      Real direction = atan2 (-u, -v) * 180 / M_PI;
+      if (direction < 0) { direction += 360; }
+      return transform.transform (Point_2D (direction, hypot (u, v)));
+   };
+
+   cr->save ();
+   cr->set_line_width (1.5);
+
+   for (Integer c = 0; c < probability_tuples.size (); c++)
+   {
+
+      const Tuple& p = probability_tuples[c];
+
+      for (const Real level : level_tuple)
+      {
+
+         // marching squares, one segment pair per cell at most
+         for (Integer i = 0; i < n - 1; i++)
+         {
+            for (Integer j = 0; j < n - 1; j++)
+            {
+
+               const Real corner[4] = { p[i * n + j], p[(i + 1) * n + j],
+                  p[(i + 1) * n + j + 1], p[i * n + j + 1] };
+               const Real cx[4] = { Real (i), Real (i + 1), Real (i + 1), Real (i) };
+               const Real cy[4] = { Real (j), Real (j), Real (j + 1), Real (j + 1) };
+
+               vector<Point_2D> crossing_tuple;
+               for (Integer e = 0; e < 4; e++)
+               {
+                  const Real a = corner[e];
+                  const Real b = corner[(e + 1) % 4];
+                  if (gsl_isnan (a) || gsl_isnan (b)) { continue; }
+                  if ((a < level) == (b < level)) { continue; }
+                  const Real f = (level - a) / (b - a);
+                  const Real x = cx[e] + f * (cx[(e + 1) % 4] - cx[e]);
+                  const Real y = cy[e] + f * (cy[(e + 1) % 4] - cy[e]);
+                  crossing_tuple.push_back (get_point (x, y));
+               }
+
+               for (Integer k = 0; k + 1 < crossing_tuple.size (); k += 2)
+               {
+                  const Point_2D& a = crossing_tuple[k];
+                  const Point_2D& b = crossing_tuple[k + 1];
+                  cr->move_to (a.x, a.y);
+                  cr->line_to (b.x, b.y);
+               }
+
+            }
+         }
+
+      }
+
+      Color (c, 0.7).cairo (cr);
+      cr->stroke ();
+
+   }
+
+   cr->restore ();
+
+}
+
+Wind_Groups::Wind_Groups ()
+   : number_of_groups (0)
+{
+}
+
+void
+Wind_Groups::set_uv (const Record::Columns& columns)
+{
+
+   const Integer n = columns.size ();
+   u_tuple.resize (n);
+   v_tuple.resize (n);
+   valid_tuple.clear ();
+   group_tuple.assign (n, -1);
+   number_of_groups = 0;
+
+   for (Integer k = 0; k < n; k++)
+   {
+      const Real direction = columns.direction_tuple[k];
+      const Real speed = columns.speed_tuple[k];
+      const Real theta = direction * M_PI / 180;
+      u_tuple[k] = -speed * sin (theta);
+      v_tuple[k] = -speed * cos (theta);
+      // faint weighted analogs would only blur the groups
+      if (columns.wind_tuple[k].is_naw ()) { continue; }
+      if (columns.weight_tuple[k] < 0.5) { continue; }
+      valid_tuple.push_back (k);
+   }
+
+}
+
+void
+Wind_Groups::sort_groups ()
+{
+
+   // largest group first, so colours stay put between time steps
+   vector<Integer> count_tuple (number_of_groups, 0);
+   for (const Integer g : group_tuple) { if (g >= 0) { count_tuple[g]++; } }
+
+   vector<Integer> order_tuple (number_of_groups);
+   for (Integer g = 0; g < number_of_groups; g++) { order_tuple[g] = g; }
+   stable_sort (order_tuple.begin (), order_tuple.end (),
+      [&] (const Integer a, const Integer b)
+      { return count_tuple[a] > count_tuple[b]; });
+
+   vector<Integer> rank_tuple (number_of_groups);
+   for (Integer r = 0; r < number_of_groups; r++) { rank_tuple[order_tuple[r]] = r; }
+   for (Integer& g : group_tuple) { if (g >= 0) { g = rank_tuple[g]; } }
+
+}
+
+void
+Wind_Groups::k_means (const Record::Columns& columns,
+                      const Integer k,
+                      const Integer max_iterations)
+{
+
+   set_uv (columns);
+   const Integer n = valid_tuple.size ();
+   if (k < 1 || n < k) { return; }
+
+   // k-means++ seeding from a fixed seed, so a rerun gives the same groups
+   mt19937_64 engine (925);
+   uniform_real_distribution<Real> uniform (0, 1);
+   vector<Real> centre_u_tuple, centre_v_tuple;
+   vector<Real> d2_tuple (n, GSL_POSINF);
+   Integer seed = Integer (uniform (engine) * n) % n;
+
+   while (true)
+   {
+
+      const Real cu = u_tuple[valid_tuple[seed]];
+      const Real cv = v_tuple[valid_tuple[seed]];
+      centre_u_tuple.push_back (cu);
+      centre_v_tuple.push_back (cv);
+      if (centre_u_tuple.size () == k) { break; }
+
+      Real total = 0;
+      for (Integer m = 0; m < n; m++)
+      {
+         const Real du = u_tuple[valid_tuple[m]] - cu;
+         const Real dv = v_tuple[valid_tuple[m]] - cv;
+         d2_tuple[m] = std::min (d2_tuple[m], du * du + dv * dv);
+         total += d2_tuple[m];
+      }
+
+      // fewer distinct winds than groups asked for
+      if (total <= 0) { break; }
+
+      Real r = uniform (engine) * total;
+      for (seed = 0; seed < n - 1; seed++)
+      {
+         r -= d2_tuple[seed];
+         if (r < 0) { break; }
+      }
+
+   }
+
+   number_of_groups = centre_u_tuple.size ();
+   const Integer ng = number_of_groups;
+   const Chunks chunks (n);
+
+   for (Integer iteration = 0; iteration < max_iterations; iteration++)
+   {
+
+      // per chunk sums of u, v and counts, merged in chunk order
+      vector<vector<Real> > sum_tuple (chunks.size (), vector<Real> (3 * ng, 0));
+      vector<Integer> changed_tuple (chunks.size (), 0);
+
+      chunks.run ([&] (const Integer c)
+      {
+         vector<Real>& sum = sum_tuple[c];
+         for (Integer m = chunks.get_start (c); m < chunks.get_end (c); m++)
+         {
+
+            const Integer record = valid_tuple[m];
+            const Real u = u_tuple[record];
+            const Real v = v_tuple[record];
+
+            Integer nearest = 0;
+            Real nearest_d2 = GSL_POSINF;
+            for (Integer g = 0; g < ng; g++)
+            {
+               const Real du = u - centre_u_tuple[g];
+               const Real dv = v - centre_v_tuple[g];
+               const Real d2 = du * du + dv * dv;
+               if (d2 < nearest_d2) { nearest_d2 = d2; nearest = g; }
+            }
+
+            if (group_tuple[record] != nearest) { changed_tuple[c]++; }
+            group_tuple[record] = nearest;
+            sum[3 * nearest] += u;
+            sum[3 * nearest + 1] += v;
+            sum[3 * nearest + 2] += 1;
+
+         }
+      });
+
+      Integer changed = 0;
+      vector<Real> total (3 * ng, 0);
+      for (Integer c = 0; c < chunks.size (); c++)
+      {
+         changed += changed_tuple[c];
+         for (Integer i = 0; i < 3 * ng; i++) { total[i] += sum_tuple[c][i]; }
+      }
+
+      // an emptied group keeps its old centre
+      for (Integer g = 0; g < ng; g++)
+      {
+         const Real count = total[3 * g + 2];
+         if (count < 1) { continue; }
+         centre_u_tuple[g] = total[3 * g] / count;
+         centre_v_tuple[g] = total[3 * g + 1] / count;
+      }
+
+      if (changed == 0) { break; }
+
+   }
+
+   sort_groups ();
+
+}
+
+void
+Wind_Groups::density (const Record::Columns& columns,
+                      const Real epsilon,
+                      const Integer min_points)
+{
+
+   set_uv (columns);
+   const Integer n = valid_tuple.size ();
+   if (n == 0) { return; }
+
+   typedef pair<Integer, Integer> Cell;
+   vector<Cell> cell_tuple (n);
+   map<Cell, Integer> count_map;
+
+   for (Integer m = 0; m < n; m++)
+   {
+      const Integer k = valid_tuple[m];
+      const Integer i = Integer (floor (u_tuple[k] / epsilon));
+      const Integer j = Integer (floor (v_tuple[k] / epsilon));
+      cell_tuple[m] = Cell (i, j);
+      count_map[cell_tuple[m]]++;
+   }
+
+   // dense cells touching each other, 8-way, make up one group
+   map<Cell, Integer> group_map;
+   for (auto& c : count_map)
+   {
+
+      if (c.second < min_points) { continue; }
+      if (group_map.find (c.first) != group_map.end ()) { continue; }
+
+      const Integer group = number_of_groups++;
+      vector<Cell> stack (1, c.first);
+      group_map[c.first] = group;
+
+      while (!stack.empty ())
+      {
+         const Cell cell = stack.back ();
+         stack.pop_back ();
+         for (Integer di = -1; di <= 1; di++)
+         {
+            for (Integer dj = -1; dj <= 1; dj++)
+            {
+               const Cell neighbour (cell.first + di, cell.second + dj);
+               auto iterator = count_map.find (neighbour);
+               if (iterator == count_map.end ()) { continue; }
+               if (iterator->second < min_points) { continue; }
+               if (group_map.find (neighbour) != group_map.end ()) { continue; }
+               group_map[neighbour] = group;
+               stack.push_back (neighbour);
+            }
+         }
+      }
+
+   }
+
+   // records in a sparse cell next to a dense one are its border points
+   for (Integer m = 0; m < n; m++)
+   {
+      const Cell& cell = cell_tuple[m];
+      for (Integer d = 0; d < 9; d++)
+      {
+         const Integer di = (d == 0 ? 0 : (d - 1) % 3 - 1);
+         const Integer dj = (d == 0 ? 0 : (d - 1) / 3 - 1);
+         const Cell neighbour (cell.first + di, cell.second + dj);
+         auto iterator = group_map.find (neighbour);
+         if (iterator == group_map.end ()) { continue; }
+         group_tuple[valid_tuple[m]] = iterator->second;
+         break;
+      }
    }
 
+   sort_groups ();
+
 }
 
+vector<Point_2D>
+Wind_Groups::get_hull (const Integer group,
+                       const Record::Projection& projection) const
+{
+
+   vector<Point_2D> point_tuple;
+   for (const Integer k : valid_tuple)
+   {
+      if (group_tuple[k] != group) { continue; }
+      point_tuple.push_back (projection.point_tuple[k]);
+   }
+
+   sort (point_tuple.begin (), point_tuple.end (),
+      [] (const Point_2D& a, const Point_2D& b)
+      { return (a.x < b.x || (a.x == b.x && a.y < b.y)); });
 
+   const Integer n = point_tuple.size ();
+   if (n < 3) { return vector<Point_2D> (); }
+
+   auto cross = [] (const Point_2D& o, const Point_2D& a, const Point_2D& b)
+   {
+      return (a.x - o.x) * (b.y - o.y) - (a.y - o.y) * (b.x - o.x);
+   };
+
+   // Andrew's monotone chain
+   vector<Point_2D> hull (2 * n);
+   Integer h = 0;
+   for (Integer i = 0; i < n; i++)
+   {
+      const Point_2D& p = point_tuple[i];
+      while (h >= 2 && cross (hull[h - 2], hull[h - 1], p) <= 0) { h--; }
+      hull[h++] = p;
+   }
+   for (Integer i = n - 2, lower = h + 1; i >= 0; i--)
+   {
+      const Point_2D& p = point_tuple[i];
+      while (h >= lower && cross (hull[h - 2], hull[h - 1], p) <= 0) { h--; }
+      hull[h++] = p;
+   }
+
+   hull.resize (h - 1);
+   return hull;
+
+}
+
+void
+Wind_Groups::feed (Clusters& clusters,
+                   const Record::Projection& projection) const
+{
+   for (Integer g = 0; g < number_of_groups; g++)
+   {
+      const vector<Point_2D>& hull = get_hull (g, projection);
+      if (hull.size () < 3) { continue; }
+      Cluster* cluster_ptr = new Cluster ();
+      for (const Point_2D& point : hull) { cluster_ptr->add (point); }
+      clusters.push_back (cluster_ptr);
+   }
+}
@@ -1,6 +1,7 @@
 #ifndef NINE2FIVE_DATA_H
 #define NINE2FIVE_DATA_H
 
+#include <functional>
 #include <set>
 #include <iostream>
 #include <denise/gtkmm.h>
@@ -8,6 +9,7 @@
 #include <denise/met.h>
 #include <denise/stat.h>
 //#include "selection.h"
+#include "schema.h"
 
 using namespace std;
 
@@ -35,10 +37,15 @@ namespace nine2five
          Wind
          wind;
 
+         // takes no room while Extra_Schema is empty
+         [[no_unique_address]] Extra_Schema::Values
+         extra;
+
          Record (const Dtime& dtime,
                  const Wind& wind_925,
                  const Real temperature_925,
-                 const Wind& wind);
+                 const Wind& wind,
+                 const Extra_Schema::Values& extra = Extra_Schema::nil ());
 
          bool
          operator == (const Record& record) const;
@@ -57,8 +64,117 @@ namespace nine2five
                void
                feed (Wind_Rose& wind_rose) const;
 
-               Sample*
-               get_temperature_925_sample_ptr () const;
+         };
+
+         // Column-wise copy of a Record::Set for tight per-record loops,
+         // speeds in knots as drawn on the Wind_Disc; each record carries
+         // an analog weight, 1 for a plain threshold match
+         class Columns
+         {
+
+            protected:
+
+               Real
+               total_weight;
+
+            public:
+
+               vector<Dtime>
+               dtime_tuple;
+
+               vector<Wind>
+               wind_tuple;
+
+               Tuple
+               direction_tuple;
+
+               Tuple
+               speed_tuple;
+
+               Tuple
+               temperature_925_tuple;
+
+               Tuple
+               direction_925_tuple;
+
+               Tuple
+               speed_925_tuple;
+
+               Tuple
+               weight_tuple;
+
+               Extra_Schema::Storage
+               extra_tuples;
+
+               Columns ();
+
+               Columns (const Record::Set& record_set);
+
+               Columns (const Columns& columns,
+                        const Tuple& weight_tuple,
+                        const Real min_weight);
+
+               void
+               add (const Record& record,
+                    const Real weight = 1);
+
+               Integer
+               size () const;
+
+               Real
+               get_total_weight () const;
+
+         };
+
+         // Canvas positions of every record in an analog set, with a fixed
+         // per-record direction jitter; kept until the Wind_Disc geometry
+         // or the analog set changes
+         class Projection
+         {
+
+            private:
+
+               const Columns*
+               columns_ptr;
+
+               Point_2D
+               reference_a;
+
+               Point_2D
+               reference_b;
+
+            public:
+
+               const Real
+               dir_scatter;
+
+               Tuple
+               jitter_tuple;
+
+               vector<Point_2D>
+               point_tuple;
+
+               vector<Point_2D>
+               noisy_point_tuple;
+
+               vector<Point_2D>
+               point_925_tuple;
+
+               Projection (const Real dir_scatter);
+
+               static Real
+               get_jitter (const Dtime& dtime);
+
+               void
+               clear ();
+
+               bool
+               is_current (const Columns& columns,
+                           const Transform_2D& transform) const;
+
+               void
+               project (const Columns& columns,
+                        const Transform_2D& transform);
 
          };
 
@@ -104,7 +220,8 @@ namespace nine2five
          Station_Data ();
 
          void
-         read (const Dstring& file_path);
+         read (const Dstring& file_path,
+               const function<bool ()>& is_cancelled = nullptr);
 
          Record::Set*
          get_record_set_ptr (const Integer day_of_year,
@@ -112,7 +229,113 @@ namespace nine2five
                              const Integer hour,
                              const Integer hour_threshold,
                              const Wind& wind_925,
-                             const Real threshold = 2.5) const;
+                             const Real threshold = 2.5,
+                             const Extra_Schema::Query& extra_query =
+                                Extra_Schema::Query (),
+                             const function<bool ()>& is_cancelled =
+                                nullptr) const;
+
+   };
+
+   // Every record of a station in columns, with the calendar and 925 hPa
+   // wind columns that smooth analog weights are worked out from
+   class Archive : public Record::Columns
+   {
+
+      public:
+
+         vector<Integer>
+         day_of_year_tuple;
+
+         vector<Integer>
+         hour_tuple;
+
+         Tuple
+         u_925_tuple;
+
+         Tuple
+         v_925_tuple;
+
+         // the commonest spacing of the record times in hours, NaN with
+         // fewer than two times
+         Real
+         time_step;
+
+         Archive (const Station_Data& station_data);
+
+         Tuple
+         get_weight_tuple (const Integer day_of_year,
+                           const Real day_of_year_scale,
+                           const Integer hour,
+                           const Real hour_scale,
+                           const Wind& wind_925,
+                           const Real wind_925_scale,
+                           const Extra_Schema::Query& extra_query =
+                              Extra_Schema::Query (),
+                           const function<bool ()>& is_cancelled =
+                              nullptr) const;
+
+   };
+
+   // Windows of 925 hPa winds over the hours before each record of an
+   // Archive, bucketed on the mean wind of the window.  The rms difference
+   // of two windows is never smaller than the difference of their means,
+   // so only the buckets near the target mean are looked at.
+   class Trajectory_Index
+   {
+
+      private:
+
+         typedef pair<Integer, Integer>
+         Cell;
+
+         const Archive&
+         archive;
+
+         const Tuple
+         lag_tuple;
+
+         const Real
+         cell_size;
+
+         vector<Integer>
+         record_tuple;
+
+         Tuple
+         window_u_tuple;
+
+         Tuple
+         window_v_tuple;
+
+         map<Cell, vector<Integer> >
+         bucket_map;
+
+         Cell
+         get_cell (const Real u,
+                   const Real v) const;
+
+      public:
+
+         Trajectory_Index (const Archive& archive,
+                           const Tuple& lag_tuple,
+                           const Real cell_size = 5);
+
+         const Tuple&
+         get_lag_tuple () const;
+
+         Integer
+         size () const;
+
+         Tuple
+         get_weight_tuple (const Tuple& u_tuple,
+                           const Tuple& v_tuple,
+                           const Real threshold,
+                           const Integer day_of_year,
+                           const Integer day_of_year_threshold,
+                           const Integer hour,
+                           const Integer hour_threshold,
+                           const function<bool ()>& is_cancelled =
+                              nullptr) const;
 
    };
 
@@ -138,9 +361,214 @@ namespace nine2five
          const Tokens&
          get_station_tokens () const;
 
+         Dstring
+         get_file_path (const Dstring& station) const;
+
          Station_Data&
          get_station_data (const Dstring& station);
 
+         // takes data read elsewhere, as by a prefetch worker
+         void
+         add_station_data (const Dstring& station,
+                           Station_Data& station_data);
+
+   };
+
+   class Extent
+   {
+
+      public:
+
+         Real
+         start_x;
+
+         Real
+         end_x;
+
+         Real
+         start_y;
+
+         Real
+         end_y;
+
+         Extent ();
+
+         bool
+         is_empty () const;
+
+         bool
+         contains (const Point_2D& point) const;
+
+         void
+         extend (const Point_2D& point);
+
+         void
+         extend (const Extent& extent);
+
+   };
+
+   // Streaming count, mean and sum of squared deviations (Welford) that
+   // can be merged with and subtracted from one another
+   class Moments
+   {
+
+      public:
+
+         Real
+         n;
+
+         Real
+         mean;
+
+         Real
+         m2;
+
+         Moments ();
+
+         void
+         clear ();
+
+         void
+         add (const Real value,
+              const Real weight = 1);
+
+         void
+         remove (const Real value,
+                 const Real weight = 1);
+
+         void
+         merge (const Moments& moments);
+
+         void
+         subtract (const Moments& moments);
+
+         Real
+         get_mean () const;
+
+         Real
+         get_variance () const;
+
+         Real
+         get_sd () const;
+
+   };
+
+   // Histogram with removals and fractional weights, so that tallies
+   // can be updated as deltas
+   class Weighted_Histogram : public map<Integer, Real>
+   {
+
+      private:
+
+         const Real
+         delta;
+
+         const Real
+         offset;
+
+         Real
+         number_of_points;
+
+      public:
+
+         Weighted_Histogram (const Real delta,
+                             const Real offset = 0);
+
+         Integer
+         get_bin (const Real value) const;
+
+         Real
+         get_edge (const Integer bin) const;
+
+         void
+         clear ();
+
+         void
+         increment (const Real value,
+                    const Real weight = 1);
+
+         void
+         decrement (const Real value,
+                    const Real weight = 1);
+
+         void
+         merge (const Weighted_Histogram& histogram);
+
+         Real
+         get_number_of_points () const;
+
+         Real
+         get_max_value () const;
+
+         void
+         render_outline (const RefPtr<Context>& cr,
+                         const Transform_2D& transform) const;
+
+   };
+
+   // Gaussian kernel density on a fixed temperature grid.  Values are
+   // linearly binned as they come and go, and the smoothed curve is only
+   // worked out again when the counts or the bandwidth have changed.
+   class Kernel_Density
+   {
+
+      private:
+
+         const Real
+         start;
+
+         const Real
+         delta;
+
+         vector<Real>
+         count_tuple;
+
+         vector<Real>
+         density_tuple;
+
+         Real
+         number_of_points;
+
+         Real
+         bandwidth;
+
+         bool
+         smoothed;
+
+      public:
+
+         Kernel_Density (const Real start = -50,
+                         const Real end = 50,
+                         const Real delta = 0.1);
+
+         void
+         clear ();
+
+         void
+         increment (const Real value,
+                    const Real weight = 1);
+
+         void
+         decrement (const Real value,
+                    const Real weight = 1);
+
+         void
+         merge (const Kernel_Density& kernel_density);
+
+         static Real
+         get_bandwidth (const Moments& moments);
+
+         void
+         smooth (const Real bandwidth);
+
+         Real
+         get_density (const Real value) const;
+
+         void
+         render (const RefPtr<Context>& cr,
+                 const Transform_2D& transform,
+                 const Real bin_size) const;
+
    };
 
    class Cluster : public denise::Polygon
@@ -148,47 +576,350 @@ namespace nine2five
 
       public:
 
-         Tuple
-         tuple;
+         vector<Point_2D>
+         vertices;
+
+         Extent
+         extent;
+
+         // unique for the life of the process, unlike the address
+         Integer
+         id;
 
-         Histogram_1D
+         Integer
+         version;
+
+         // whether the chain of edges so far, and the closed outline,
+         // never cross themselves
+         bool
+         chain_simple;
+
+         bool
+         simple;
+
+         Moments
+         moments;
+
+         Weighted_Histogram
          histogram;
 
+         Kernel_Density
+         kernel_density;
+
          Real
          probability;
 
+         Wind
+         total_wind;
+
+         // the weight behind total_wind, which unlike the histogram
+         // also counts records without a 925 hPa temperature
+         Real
+         wind_weight;
+
          Wind
          mean_wind;
 
          Cluster ();
 
+         virtual
+         ~Cluster ();
+
+         void
+         add (const Point_2D& point);
+
+         virtual bool
+         is_analytic () const;
+
+         virtual bool
+         contains_wind (const Real direction,
+                        const Real speed) const;
+
+         virtual void
+         cairo (const RefPtr<Context>& cr) const;
+
+         virtual Cluster*
+         clone () const;
+
+         // the kernel density is only binned with_kde
+         void
+         include (const Real temperature_925,
+                  const Wind& wind,
+                  const Real weight = 1,
+                  const bool with_kde = false);
+
+         void
+         exclude (const Real temperature_925,
+                  const Wind& wind,
+                  const Real weight = 1,
+                  const bool with_kde = false);
+
+         void
+         merge_tally (const Moments& moments,
+                      const Weighted_Histogram& histogram,
+                      const Kernel_Density* kernel_density_ptr,
+                      const Wind& total_wind,
+                      const Real wind_weight);
+
+         void
+         clear_tally ();
+
+         void
+         smooth ();
+
          Gaussian_Distribution
          get_gaussian_distribution () const;
 
          Real
          get_likelihood (const Real temperature_925,
-                         const Integer n) const;
+                         const Real n,
+                         const bool with_kde = false) const;
          
    };
 
+   // Annular sector in wind space, direction in degrees and speed in knots.
+   // Speed circles, annuli and plain direction sectors are special cases.
+   class Sector_Cluster : public Cluster
+   {
+
+      private:
+
+         vector<Point_2D>
+         inner_arc;
+
+         vector<Point_2D>
+         outer_arc;
+
+      public:
+
+         const Real
+         start_direction;
+
+         const Real
+         end_direction;
+
+         const Real
+         start_speed;
+
+         const Real
+         end_speed;
+
+         Sector_Cluster (const Wind_Disc::Transform& transform,
+                         const Real start_direction,
+                         const Real end_direction,
+                         const Real start_speed,
+                         const Real end_speed,
+                         const Real outline_speed = 40);
+
+         bool
+         is_full_circle () const;
+
+         bool
+         is_analytic () const;
+
+         bool
+         contains_wind (const Real direction,
+                        const Real speed) const;
+
+         void
+         cairo (const RefPtr<Context>& cr) const;
+
+         Cluster*
+         clone () const;
+
+   };
+
    class Clusters : public vector<Cluster*>
    {
 
+      public:
+
+         // Cluster-ID grid over the canvas, so that membership is a single
+         // lookup except in cells crossed by an outline
+         class Mask
+         {
+
+            private:
+
+               static const Integer
+               boundary = -2;
+
+               const Real
+               cell_size;
+
+               Real
+               start_x;
+
+               Real
+               start_y;
+
+               Integer
+               ni;
+
+               Integer
+               nj;
+
+               vector<Integer>
+               cell_tuple;
+
+               vector<Integer>
+               index_tuple;
+
+               vector<Integer>
+               id_tuple;
+
+               vector<Integer>
+               version_tuple;
+
+               void
+               fill (const Cluster& cluster,
+                     const Integer index,
+                     vector<Integer>& corner_tuple) const;
+
+               void
+               mark (const Point_2D& point_a,
+                     const Point_2D& point_b);
+
+            public:
+
+               Mask (const Real cell_size = 2);
+
+               bool
+               is_current (const Clusters& clusters) const;
+
+               void
+               build (const Clusters& clusters);
+
+               Integer
+               get_index (const Point_2D& point,
+                          const Clusters& clusters) const;
+
+         };
+
+         // tallies of one chunk of records in a parallel cluster_analysis;
+         // slot 0 is the rest, slot i + 1 is cluster i
+         class Partial
+         {
+
+            public:
+
+               Moments
+               moments;
+
+               vector<Moments>
+               moments_tuple;
+
+               vector<Weighted_Histogram>
+               histogram_tuple;
+
+               bool
+               with_kde;
+
+               // empty unless with_kde
+               vector<Kernel_Density>
+               kernel_density_tuple;
+
+               vector<Wind>
+               total_wind_tuple;
+
+               vector<Real>
+               wind_weight_tuple;
+
+               Partial (const Integer number_of_clusters,
+                        const bool with_kde);
+
+               void
+               include (const Integer index,
+                        const Real temperature_925,
+                        const Wind& wind,
+                        const Real weight);
+
+         };
+
+      private:
+
+         Mask
+         mask;
+
+         Cluster
+         rest;
+
+         Moments
+         moments;
+
+         // per-record state of the last cluster_analysis, kept so that a
+         // growing outline only retests the records it sweeps over
+         const Record::Columns*
+         columns_ptr;
+
+         const Record::Projection*
+         projection_ptr;
+
+         vector<Integer>
+         index_tuple;
+
+         vector<Integer>
+         analysed_id_tuple;
+
+         vector<Integer>
+         analysed_version_tuple;
+
+         bool
+         analysed_with_kde;
+
+         Extent
+         dirty_extent;
+
+         bool
+         is_analysed (const Record::Columns& columns) const;
+
+         Cluster&
+         get_tally (const Integer index);
+
+         void
+         assign (const Record::Columns& columns,
+                 const Record::Projection& projection,
+                 Wind_Rose* wind_rose_ptr,
+                 Histogram_1D* histogram_ptr);
+
+         void
+         reassign ();
+
       public:
 
          Integer
          defining;
 
+         // likelihoods from the kernel density instead of a Gaussian fit
+         bool
+         with_kde;
+
          Clusters ();
 
          ~Clusters ();
 
+         // a copy for another thread to classify with while this one is
+         // edited; it builds its own mask on refresh_mask
+         Clusters*
+         clone () const;
+
          bool
          is_defining () const;
 
+         bool
+         is_rasterized (const Integer index) const;
+
+         void
+         refresh_mask ();
+
          Integer
          get_index (const Point_2D& point) const;
 
+         Integer
+         get_index (const Point_2D& point,
+                    const Real direction,
+                    const Real speed) const;
+
          Cluster&
          get_cluster (const Integer index);
 
@@ -220,6 +951,15 @@ namespace nine2five
          void
          reset ();
 
+         const vector<Integer>&
+         get_index_tuple () const;
+
+         const Moments&
+         get_moments () const;
+
+         const Cluster&
+         get_rest () const;
+
          void
          render (const RefPtr<Context>& cr,
                  const Real alpha) const;
@@ -228,9 +968,258 @@ namespace nine2five
          render_defining (const RefPtr<Context>& cr) const;
 
          void
-         cluster_analysis (const Record::Set& record_set,
+         cluster_analysis (const Record::Columns& columns,
+                           const Record::Projection& projection,
+                           const Predictor& predictor,
+                           Wind_Rose* wind_rose_ptr = nullptr,
+                           Histogram_1D* histogram_ptr = nullptr);
+
+   };
+
+   // Spread of the cluster probabilities under resampling of the analog
+   // set with replacement; gives the 5% and 95% points per cluster
+   class Bootstrap
+   {
+
+      public:
+
+         // what the replicates need from the analysed clusters and the
+         // analog set, copied so that they can be drawn on another thread
+         class Sample
+         {
+
+            public:
+
+               Real
+               temperature_925;
+
+               bool
+               with_kde;
+
+               Integer
+               number_of_clusters;
+
+               // slot 0 is the rest, slot i + 1 is cluster i, -1 has no wind
+               vector<Integer>
+               slot_tuple;
+
+               Tuple
+               weight_tuple;
+
+               Tuple
+               temperature_925_tuple;
+
+               Tuple
+               bandwidth_tuple;
+
+               Sample (const Clusters& clusters,
+                       const Record::Columns& columns,
+                       const Real temperature_925,
+                       const bool with_kde);
+
+         };
+
+         Integer
+         number_of_replicates;
+
+         Tuple
+         lower_tuple;
+
+         Tuple
+         upper_tuple;
+
+         Bootstrap ();
+
+         void
+         clear ();
+
+         // false if cancelled part way
+         bool
+         run (const Sample& sample,
+              const function<bool ()>& is_cancelled,
+              const Integer max_replicates = 4000);
+
+   };
+
+   // Cluster probability as a function of one analog threshold; the
+   // candidates are sorted by their distance once and swept with prefix
+   // moments, one threshold after another
+   class Sensitivity
+   {
+
+      public:
+
+         // what a sweep needs from the candidates, with each one placed
+         // in its cluster
+         class Candidates
+         {
+
+            public:
+
+               Integer
+               number_of_clusters;
+
+               Tuple
+               temperature_925_tuple;
+
+               Tuple
+               weight_tuple;
+
+               Tuple
+               distance_tuple;
+
+               vector<Integer>
+               slot_tuple;
+
+               Candidates (const Clusters& clusters,
+                           const Record::Columns& columns,
                            const Transform_2D& transform,
-                           const Predictor& predictor);
+                           const Tuple& distance_tuple);
+
+         };
+
+         Tuple
+         threshold_tuple;
+
+         vector<Tuple>
+         probability_tuples;
+
+         void
+         clear ();
+
+         bool
+         sweep (const Candidates& candidates,
+                const Tuple& threshold_tuple,
+                const bool inclusive,
+                const Real temperature_925,
+                const function<bool ()>& is_cancelled);
+
+         void
+         render (const RefPtr<Context>& cr,
+                 const Box_2D& box_2d,
+                 const Real threshold,
+                 const Dstring& title) const;
+
+   };
+
+   // Cluster probabilities over a grid of 925 hPa predictor winds, u and
+   // v in knots; every node stands for a full analog query and cluster
+   // analysis, so dragging the predictor can read them off the table
+   class Response_Surface
+   {
+
+      public:
+
+         // what a node needs from the analog candidates, with each one
+         // placed in its cluster
+         class Candidates
+         {
+
+            public:
+
+               Integer
+               number_of_clusters;
+
+               Tuple
+               u_925_tuple;
+
+               Tuple
+               v_925_tuple;
+
+               Tuple
+               temperature_925_tuple;
+
+               vector<Integer>
+               slot_tuple;
+
+               Candidates (const Clusters& clusters,
+                           const Record::Columns& columns,
+                           const Transform_2D& transform);
+
+         };
+
+         const Real
+         extent;
+
+         const Real
+         delta;
+
+         const Integer
+         n;
+
+         vector<Tuple>
+         probability_tuples;
+
+         Response_Surface (const Real extent = 40,
+                           const Real delta = 2);
+
+         bool
+         compute (const Candidates& candidates,
+                  const Real threshold,
+                  const Real temperature_925,
+                  const function<bool ()>& is_cancelled);
+
+         Real
+         get_probability (const Integer cluster_index,
+                          const Wind& wind_925) const;
+
+         void
+         render (const RefPtr<Context>& cr,
+                 const Transform_2D& transform,
+                 const Tuple& level_tuple) const;
+
+   };
+
+   // Automatic grouping of the surface winds of an analog set in (u, v)
+   // space, by k-means or by density; group -1 holds the noise and the
+   // records without a wind
+   class Wind_Groups
+   {
+
+      private:
+
+         Tuple
+         u_tuple;
+
+         Tuple
+         v_tuple;
+
+         vector<Integer>
+         valid_tuple;
+
+         void
+         set_uv (const Record::Columns& columns);
+
+         void
+         sort_groups ();
+
+      public:
+
+         vector<Integer>
+         group_tuple;
+
+         Integer
+         number_of_groups;
+
+         Wind_Groups ();
+
+         void
+         k_means (const Record::Columns& columns,
+                  const Integer k,
+                  const Integer max_iterations = 50);
+
+         void
+         density (const Record::Columns& columns,
+                  const Real epsilon,
+                  const Integer min_points);
+
+         vector<Point_2D>
+         get_hull (const Integer group,
+                   const Record::Projection& projection) const;
+
+         void
+         feed (Clusters& clusters,
+               const Record::Projection& projection) const;
 
    };
 
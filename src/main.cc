@@ -15,6 +15,7 @@ main (int argc,
 
    static struct option long_options[] =
    {
+      { "benchmark",                  0, 0, 'b' },
       { "command-line",               0, 0, 'c' },
       { "gradient-wind",              1, 0, 'G' },
       { "geometry",                   1, 0, 'g' },
@@ -29,8 +30,7 @@ main (int argc,
    try
    {
 
-      const string data_path = getenv ("NINE2FIVE_DATA");
-
+      bool benchmark = false;
       bool command_line = false;
       Tokens station_tokens;
       Size_2D size_2d (1000, 800);
@@ -44,7 +44,7 @@ main (int argc,
 
       int c;
       int option_index = 0;
-      char optstring[] = "cG:g:l:n:S:s:t:x:";
+      char optstring[] = "bcG:g:l:n:S:s:t:x:";
 
       while ((c = getopt_long (argc, argv, optstring,
              long_options, &option_index)) != -1)
@@ -53,6 +53,12 @@ main (int argc,
          switch (c)
          {
 
+            case 'b':
+            {
+               benchmark = true;
+               break;
+            }
+
             case 'c':
             {
                command_line = true;
@@ -127,10 +133,23 @@ main (int argc,
 
       const Real size = size_2d.j / 2.4;
       const Point_2D origin (size_2d.i * 0.5, size_2d.j * 0.5);
-      Data data (data_path, station_tokens);
       Wind_Disc wind_disc (number_of_directions, threshold_tuple,
          origin, size * 0.2, speed_label_tuple, max_speed);
 
+      if (benchmark)
+      {
+         const Wind_Disc::Transform& transform = wind_disc.get_transform ();
+         Scatter_Plot::benchmark (transform, size_2d);
+         return 0;
+      }
+
+      // the benchmark above needs no station data
+      const char* data_env = getenv ("NINE2FIVE_DATA");
+      if (data_env == nullptr) { throw Exception ("NINE2FIVE_DATA is not set."); }
+      const string data_path (data_env);
+
+      Data data (data_path, station_tokens);
+
       if (sequence_dir_path != "")
       {
 
@@ -1,6 +1,9 @@
+#include <chrono>
+#include <random>
 #include <gtkmm/messagedialog.h>
 #include <denise/histogram.h>
 #include "data.h"
+#include "parallel.h"
 #include "selection.h"
 #include "nine2five.h"
 
@@ -44,26 +47,53 @@ Option_Panel::Option_Panel (Nine2five& nine2five)
      nine2five (nine2five),
      day_of_year_threshold_button (nine2five, true, 12),
      hour_threshold_button (nine2five, true, 12),
+     weighted_button (nine2five, "Weighted", 12, false),
+     trajectory_button (nine2five, true, 12),
      noise_button (nine2five, "Noise", 12, false),
      outline_button (nine2five, "Outline", 12, false),
      cluster_button (nine2five, "Clusters", 12, true),
      percentages_button (nine2five, "Percentages", 12, false),
+     bootstrap_button (nine2five, "Bootstrap", 12, false),
+     kde_button (nine2five, "KDE", 12, false),
+     sensitivity_button (nine2five, "Sensitivity", 12, false),
+     surface_button (nine2five, "Surface", 12, false),
      clear_clusters_button (nine2five, "Clear", 12),
      calm_3_cluster_button (nine2five, "Calm 3 kt", 12),
      calm_5_cluster_button (nine2five, "Calm 5 kt", 12),
      calm_7_cluster_button (nine2five, "Calm 7 kt", 12),
+     n_sector_button (nine2five, "N", 12),
+     e_sector_button (nine2five, "E", 12),
+     s_sector_button (nine2five, "S", 12),
+     w_sector_button (nine2five, "W", 12),
+     group_button (nine2five, true, 12),
+     dots_button (nine2five, true, 12),
+     k_means_button (nine2five, "K-means", 12),
+     density_button (nine2five, "Density", 12),
      auto_925_wind_button (nine2five, "Auto", 12, true),
-     save_button (nine2five, "Save", 12)
+     save_button (nine2five, "Save", 12),
+     scale_button (nine2five, true, 12),
+     play_button (nine2five, "Play", 12, false),
+     export_button (nine2five, "Export", 12)
 {
 
    const Dstring s ("5 days:10 days:*15 days:30 days:45 days:60 days:90 days");
    day_of_year_threshold_button.add_tokens (Tokens (s, ":"));
    hour_threshold_button.add_tokens (Tokens ("0 hr:1 hr:2 hr:3 hr", ":"));
+   trajectory_button.add_tokens (Tokens ("*Off:6 hr:12 hr", ":"));
+   group_button.add_tokens (Tokens ("2 groups:*3 groups:4 groups:5 groups:6 groups", ":"));
+   dots_button.add_tokens (Tokens ("2000 dots:*5000 dots:20000 dots:All dots", ":"));
+   scale_button.add_tokens (Tokens ("*1x:2x:4x:8x", ":"));
 
    day_of_year_threshold_button.get_update_signal ().connect (
       sigc::mem_fun (nine2five, &Nine2five::render_queue_draw));
    hour_threshold_button.get_update_signal ().connect (
       sigc::mem_fun (nine2five, &Nine2five::render_queue_draw));
+   weighted_button.get_signal ().connect (sigc::mem_fun (
+      nine2five, &Nine2five::render_queue_draw));
+   trajectory_button.get_update_signal ().connect (
+      sigc::mem_fun (nine2five, &Nine2five::render_queue_draw));
+   dots_button.get_update_signal ().connect (
+      sigc::mem_fun (nine2five, &Nine2five::render_queue_draw));
 
    clear_clusters_button.get_signal ().connect (sigc::mem_fun (
       nine2five, &Nine2five::clear_clusters));
@@ -73,6 +103,20 @@ Option_Panel::Option_Panel (Nine2five& nine2five)
       nine2five, &Nine2five::make_calm_cluster));
    calm_7_cluster_button.get_str_signal ().connect (sigc::mem_fun (
       nine2five, &Nine2five::make_calm_cluster));
+   n_sector_button.get_str_signal ().connect (sigc::mem_fun (
+      nine2five, &Nine2five::make_sector_cluster));
+   e_sector_button.get_str_signal ().connect (sigc::mem_fun (
+      nine2five, &Nine2five::make_sector_cluster));
+   s_sector_button.get_str_signal ().connect (sigc::mem_fun (
+      nine2five, &Nine2five::make_sector_cluster));
+   w_sector_button.get_str_signal ().connect (sigc::mem_fun (
+      nine2five, &Nine2five::make_sector_cluster));
+   group_button.get_update_signal ().connect (
+      sigc::mem_fun (nine2five, &Nine2five::regroup));
+   k_means_button.get_str_signal ().connect (sigc::mem_fun (
+      nine2five, &Nine2five::make_auto_clusters));
+   density_button.get_str_signal ().connect (sigc::mem_fun (
+      nine2five, &Nine2five::make_auto_clusters));
 
    noise_button.get_signal ().connect (sigc::mem_fun (
       nine2five, &Nine2five::render_queue_draw));
@@ -82,26 +126,58 @@ Option_Panel::Option_Panel (Nine2five& nine2five)
       nine2five, &Nine2five::render_queue_draw));
    percentages_button.get_signal ().connect (sigc::mem_fun (
       nine2five, &Nine2five::render_queue_draw));
+   bootstrap_button.get_signal ().connect (sigc::mem_fun (
+      nine2five, &Nine2five::render_queue_draw));
+   kde_button.get_signal ().connect (sigc::mem_fun (
+      nine2five, &Nine2five::render_queue_draw));
+   sensitivity_button.get_signal ().connect (sigc::mem_fun (
+      nine2five, &Nine2five::render_queue_draw));
+   surface_button.get_signal ().connect (sigc::mem_fun (
+      nine2five, &Nine2five::render_queue_draw));
 
    save_button.get_signal ().connect (sigc::mem_fun (
       nine2five, &Nine2five::save_image));
+   play_button.get_signal ().connect (sigc::mem_fun (
+      nine2five, &Nine2five::update_playback));
+   export_button.get_signal ().connect (sigc::mem_fun (
+      nine2five, &Nine2five::export_series));
 
    add_widget_ptr ("Threshold", &day_of_year_threshold_button);
    add_widget_ptr ("Threshold", &hour_threshold_button);
+   add_widget_ptr ("Threshold", &weighted_button);
+   add_widget_ptr ("Threshold", &trajectory_button);
 
    add_widget_ptr ("Clusters", &clear_clusters_button);
    add_widget_ptr ("Clusters", &calm_3_cluster_button);
    add_widget_ptr ("Clusters", &calm_5_cluster_button);
    add_widget_ptr ("Clusters", &calm_7_cluster_button);
 
+   add_widget_ptr ("Sectors", &n_sector_button);
+   add_widget_ptr ("Sectors", &e_sector_button);
+   add_widget_ptr ("Sectors", &s_sector_button);
+   add_widget_ptr ("Sectors", &w_sector_button);
+
+   add_widget_ptr ("Automatic", &group_button);
+   add_widget_ptr ("Automatic", &k_means_button);
+   add_widget_ptr ("Automatic", &density_button);
+
    add_widget_ptr ("Show", &noise_button);
    add_widget_ptr ("Show", &outline_button);
    add_widget_ptr ("Show", &cluster_button);
    add_widget_ptr ("Show", &percentages_button);
+   add_widget_ptr ("Show", &bootstrap_button);
+   add_widget_ptr ("Show", &kde_button);
+   add_widget_ptr ("Show", &sensitivity_button);
+   add_widget_ptr ("Show", &surface_button);
+   add_widget_ptr ("Show", &dots_button);
 
    add_widget_ptr ("925hPa Wind", &auto_925_wind_button);
 
-   //add_widget_ptr ("Tool", &save_button);
+   add_widget_ptr ("Playback", &play_button);
+   add_widget_ptr ("Playback", &export_button);
+
+   add_widget_ptr ("Save", &scale_button);
+   add_widget_ptr ("Save", &save_button);
 
 }
 
@@ -133,6 +209,13 @@ Option_Panel::toggle_percentages ()
    nine2five.queue_draw ();
 }
 
+void
+Option_Panel::toggle_play ()
+{
+   play_button.toggle ();
+   nine2five.update_playback ();
+}
+
 bool
 Option_Panel::with_noise () const
 {
@@ -157,6 +240,37 @@ Option_Panel::with_percentages () const
    return percentages_button.is_switched_on ();
 }
 
+bool
+Option_Panel::with_bootstrap () const
+{
+   return bootstrap_button.is_switched_on ();
+}
+
+bool
+Option_Panel::with_kde () const
+{
+   return kde_button.is_switched_on ();
+}
+
+bool
+Option_Panel::with_sensitivity () const
+{
+   return sensitivity_button.is_switched_on ();
+}
+
+bool
+Option_Panel::with_surface () const
+{
+   return surface_button.is_switched_on ();
+}
+
+Integer
+Option_Panel::get_max_dots () const
+{
+   const Dstring& str = dots_button.get_str ();
+   return (str == "All dots" ? -1 : stoi (Tokens (str)[0]));
+}
+
 Integer
 Option_Panel::get_day_of_year_threshold () const
 {
@@ -169,12 +283,44 @@ Option_Panel::get_hour_threshold () const
    return stoi (Tokens (hour_threshold_button.get_str ())[0]);
 }
 
+Integer
+Option_Panel::get_number_of_groups () const
+{
+   return stoi (Tokens (group_button.get_str ())[0]);
+}
+
+bool
+Option_Panel::with_weighted_analogs () const
+{
+   return weighted_button.is_switched_on ();
+}
+
+Integer
+Option_Panel::get_trajectory_hours () const
+{
+   const Dstring& str = Tokens (trajectory_button.get_str ())[0];
+   return (str == "Off" ? 0 : stoi (str));
+}
+
 bool
 Option_Panel::auto_925_wind () const
 {
    return auto_925_wind_button.is_switched_on ();
 }
 
+bool
+Option_Panel::is_playing () const
+{
+   return play_button.is_switched_on ();
+}
+
+Real
+Option_Panel::get_export_scale () const
+{
+   const Dstring& str = scale_button.get_str ();
+   return stof (str.substr (0, str.size () - 1));
+}
+
 void
 Nine2five::pack ()
 {
@@ -231,29 +377,15 @@ Nine2five::pack ()
 
 void
 Nine2five::render_histogram (const RefPtr<Context>& cr,
-                             const Record::Set& record_set,
                              const Predictor& predictor) const
 {
 
-   Histogram_1D histogram_1d (1, 0.5);
+   const Histogram_1D& histogram_1d = histogram;
 
    const Size_2D size_2d (80, 260);
    const Index_2D index_2d (width - 40 - size_2d.i, 120);
    const Box_2D box_2d (index_2d, size_2d);
 
-   Tuple temperature_925_tuple;
-
-   for (const Record& record : record_set)
-   {
-      const Wind& wind = record.wind;
-      const Real d = wind.get_direction ();
-      const Real s = wind.get_speed () / 0.51444444;
-      const Transform_2D& transform = wind_disc.get_transform ();
-      const Point_2D& p = transform.transform (Point_2D (d, s));
-      histogram_1d.increment (record.temperature_925);
-      temperature_925_tuple.push_back (record.temperature_925);
-   }
-
    const Integer count = histogram_1d.get_number_of_points ();
    if (count == 0) { return; }
 
@@ -276,11 +408,14 @@ Nine2five::render_histogram (const RefPtr<Context>& cr,
    label.cairo (cr, Color::gray (0.2, 0.7),
       Color::gray (0.8, 0.9), Point_2D (-3, 3));
 
+   const bool with_interval = option_panel.with_bootstrap () &&
+      !clusters.is_defining () && bootstrap.number_of_replicates > 0;
+
    for (Integer i = 0; i < clusters.size (); i++)
    {
 
       const Cluster& cluster = clusters.get_cluster (i);
-      const Histogram_1D& h = cluster.histogram;
+      const Weighted_Histogram& h = cluster.histogram;
 
       if (count > 0)
       {
@@ -288,14 +423,27 @@ Nine2five::render_histogram (const RefPtr<Context>& cr,
          cr->set_line_width (3);
          Color (i, 0.8).cairo (cr);
          h.render_outline (cr, transform);
+         if (clusters.with_kde)
+         {
+            cr->set_line_width (1.5);
+            cluster.kernel_density.render (cr, transform, 1);
+         }
          cr->restore ();
       }
 
       {
          const Integer d_i = (i + 1) * 15;
-         const Integer n_i = h.get_number_of_points ();
+         const Real n_i = h.get_number_of_points ();
          const Real p = cluster.probability * 100;
-         const Dstring& str = Dstring::render (fmt + " %.2f%%", n_i, p);
+         const bool interval = with_interval && i < bootstrap.lower_tuple.size ();
+         const Real p_5 = (interval ? bootstrap.lower_tuple[i] * 100 : GSL_NAN);
+         const Real p_95 = (interval ? bootstrap.upper_tuple[i] * 100 : GSL_NAN);
+         // with analog weights the count is a sum of weights
+         const Dstring fmt_n (n_i == round (n_i) ?
+            (count == 1 ? "%.0f point" : "%.0f points") : "%.1f weight");
+         const Dstring& fmt_p = (interval ?
+            fmt_n + " %.2f%% [%.0f\u2013%.0f%%]" : fmt_n + " %.2f%%");
+         const Dstring& str = Dstring::render (fmt_p, n_i, p, p_5, p_95);
          Label label (str, anchor + Point_2D (0, d_i), 'l', 't');
          label.cairo (cr, Color (i, 0.9), Color (i, 0.3), Point_2D (-3, 3));
       }
@@ -314,69 +462,22 @@ Nine2five::render_histogram (const RefPtr<Context>& cr,
 
 }
 
-void
-Nine2five::render_scatter_plot (const RefPtr<Context>& cr,
-                                const Record::Set& record_set,
-                                const Real dir_scatter) const
+Async_Layer::Draw
+Nine2five::get_scatter_draw (const Record::Columns& columns,
+                             const Record::Projection& projection,
+                             const bool with_noise) const
 {
 
-   const Wind_Disc::Transform& t = wind_disc.get_transform ();
-
-   const Real scatter_ring_size = 8;
-   const Integer n = record_set.size ();
-   const Real alpha = bound (50.0 / n, 0.45, 0.05);
-   const Ring ring (scatter_ring_size);
-
-   const Sample* sample_ptr = record_set.get_temperature_925_sample_ptr ();
-   const Real mean = sample_ptr->get_mean ();
-   const Real sd = sample_ptr->get_sd ();
-   const Real min_temp = mean - 2 * sd;
-   const Real max_temp = mean + 2 * sd;
-   const Real delta_temp = max_temp - min_temp;
-   delete sample_ptr;
-
-   srand (0);
-
-   cr->save ();
-   cr->set_line_width (0.5);
-   Dashes ("1:2").cairo (cr);
+   const vector<Integer>& index_tuple = clusters.get_index_tuple ();
+   const Integer max_dots = option_panel.get_max_dots ();
+   const Scatter_Plot::Snapshot snapshot (columns, projection,
+      index_tuple, with_noise, max_dots);
 
-   for (const Record& record : record_set)
+   const Scatter_Plot& scatter_plot = this->scatter_plot;
+   return [&scatter_plot, snapshot] (const RefPtr<Context>& cr)
    {
-
-      const Wind& wind = record.wind;
-      const Real multiplier = 0.51444444;
-      const Real speed = wind.get_speed () / multiplier;
-
-      if (wind.is_naw ()) { continue; }
-
-      const Integer i = clusters.get_index (
-         t.transform (Point_2D (wind.get_direction (), speed)));
-      const Color& color = (i<0 ? Color::gray (0.5, alpha) : Color (i, alpha));
-
-      const Real r = random (dir_scatter, -dir_scatter);
-      const Real direction = wind.get_direction () + r;
-      const Point_2D p = t.transform (Point_2D (direction, speed));
-
-      ring.cairo (cr, p);
-      color.cairo (cr);
-      cr->fill ();
-
-      const Wind& gw = record.wind_925;
-      const Real d_gw = gw.get_direction ();
-      const Real s_gw = gw.get_speed () / multiplier;
-      const Point_2D p_gw = t.transform (Point_2D (d_gw, s_gw));
-      Label ("G", p_gw, 'c', 'c').cairo (cr);
-
-      cr->save ();
-      Edge (p, p_gw).cairo (cr);
-      cr->stroke ();
-      cr->restore ();
-
-   }
-
-   cr->restore ();
-
+      scatter_plot.render (cr, snapshot);
+   };
 
 }
 
@@ -433,51 +534,174 @@ Nine2five::render (const RefPtr<Context>& cr,
 
    title.set (date_str, station, time_str);
 
-   wind_disc.clear ();
-   Station_Data& station_data = data.get_station_data (station);
-   const Record::Set* record_set_ptr = get_record_set_ptr (dtime, predictor);
-   record_set_ptr->feed (wind_disc);
+   // each stage is only worked out again when what it reads has changed
+   for (Stage* stage_ptr : stage_ptr_tuple) { stage_ptr->recomputed = false; }
+
+   // while G is dragged the surface stands in for the analog query
+   const bool from_surface = defining_predictor &&
+      option_panel.with_surface () &&
+      columns_ptr != nullptr && surface_ptr != nullptr &&
+      surface_key == get_surface_key (dtime, predictor) &&
+      predictor.wind_925.get_speed () / 0.51444444 < surface_ptr->extent;
+   if (!from_surface &&
+       snapshot_stage.update (get_columns_key (station, dtime, predictor)))
+   {
+      get_columns (dtime, predictor);
+   }
 
-   const Real hue = 0.33;
-   const Real dir_scatter = (with_noise ? 5 : 0);
-   wind_disc.render_bg (cr);
+   // a finished query swaps its analog set in between frames
+   const Record::Columns& columns = *columns_ptr;
+   query_stage.update (columns_key + Dstring::render (":%p", &columns));
 
-   for (Cluster* cluster_ptr : clusters) { cluster_ptr->histogram.clear (); }
-   clusters.cluster_analysis (*record_set_ptr, t, predictor);
-   render_scatter_plot (cr, *record_set_ptr, dir_scatter);
+   const Dstring& disc_key = get_disc_key ();
+   if (projection_stage.update (disc_key +
+       Dstring::render (":%d", query_stage.version)))
+   {
+      // records are only projected again when the wind disc is repacked
+      if (!projection.is_current (columns, t))
+      {
+         projection.project (columns, t);
+         clusters.reset ();
+         grouped = false;
+      }
+   }
 
-   for (Integer i = 0; i < clusters.size (); i++)
+   if (!grouping.empty () && !grouped)
    {
-      const Cluster& cluster = *(clusters.at (i));
-      const Wind& mean_wind = cluster.mean_wind;
-      const Real direction = mean_wind.get_direction ();
-      const Real speed = mean_wind.get_speed () / 0.5144444;
-      const Point_2D p = t.transform (Point_2D (direction, speed));
-      cr->save ();
-      Star (10).cairo (cr, p);
-      Color (i, 0.8).cairo (cr);
-      cr->fill_preserve ();
-      Color::black ().cairo (cr);
-      cr->stroke ();
-      cr->restore ();
+      group (columns);
+      grouped = true;
    }
 
-   if (with_outline) { wind_disc.render_percentage_d (cr, hue); }
-   if (with_percentages) { wind_disc.render_percentages (cr); }
+   clusters.with_kde = option_panel.with_kde ();
 
-   render_histogram (cr, *record_set_ptr, predictor);
+   const Wind& w = predictor.wind_925;
+   Dstring clusters_stage_key = get_clusters_key () + Dstring::render (
+      "%d:%d:%d:%f", projection_stage.version,
+      clusters.defining, clusters.with_kde, predictor.temperature_925);
+   if (from_surface)
+   {
+      clusters_stage_key += Dstring::render (":%f:%f",
+         w.get_direction (), w.get_speed ());
+   }
 
+   // the wind rose and histogram only change with the analog set
+   if (!summarized) { clusters_stage.invalidate (); }
+   if (clusters_stage.update (clusters_stage_key))
    {
-      const Predictor::Sequence& sequence = sequence_map.at (station);
-      const Dtime& dtime = time_chooser.get_time ();
-      render_predictor (cr, sequence.at (dtime), false);
+
+      if (summarized)
+      {
+         clusters.cluster_analysis (columns, projection, predictor);
+      }
+      else
+      {
+         wind_disc.clear ();
+         histogram.clear ();
+         summary_version++;
+         clusters.cluster_analysis (columns, projection,
+            predictor, &wind_disc, &histogram);
+         summarized = true;
+      }
+
+      if (from_surface)
+      {
+         for (Integer i = 0; i < clusters.size (); i++)
+         {
+            clusters.at (i)->probability = surface_ptr->get_probability (i, w);
+         }
+      }
+
    }
-   render_predictor (cr, predictor, true);
 
-   if (with_cluster) { clusters.render (cr, 0.4); }
-   clusters.render_defining (cr);
+   // intervals wait until an outline being drawn is finished
+   const bool is_defining = clusters.is_defining ();
+   const Dstring& statistics_stage_key = Dstring::render (
+      "%d:%s:%f:%f:%f:%d:%d:%d:%d", clusters_stage.version,
+      dtime.get_string ("%Y%m%d%H%M").c_str (), w.get_direction (),
+      w.get_speed (), predictor.temperature_925,
+      option_panel.with_bootstrap (), option_panel.with_sensitivity (),
+      option_panel.with_surface (), is_defining);
+   if (statistics_stage.update (statistics_stage_key) && !is_defining)
+   {
+
+      if (option_panel.with_bootstrap ())
+      {
+         update_bootstrap (predictor);
+      }
+
+      if (option_panel.with_sensitivity ())
+      {
+         update_sensitivity (dtime, predictor);
+      }
+
+      if (option_panel.with_surface ())
+      {
+         update_surface (dtime, predictor);
+      }
+
+   }
+
+   const Real hue = 0.33;
+   const Size_2D& size_2d = get_size_2d ();
+   const Dstring& clusters_key = get_clusters_key ();
+
+   // each layer is only redrawn when what it shows has changed
+   const Dstring& bg_key = disc_key + Dstring::render (":%d", summary_version);
+   disc_layer_stage.update (bg_key);
+   disc_layer.render (cr, size_2d, bg_key, [&] (const RefPtr<Context>& cr)
+   {
+      wind_disc.render_bg (cr);
+   });
+
+   const Dstring& scatter_key = disc_key + ":" + columns_key + ":" +
+      clusters_key + Dstring::render (":%d:%d", Integer (with_noise),
+      option_panel.get_max_dots ());
+   // the only layer off the main thread; the analysis above and the
+   // other layers read widgets and clusters that input handlers change
+   scatter_layer_stage.update (scatter_key);
+   scatter_layer.render (cr, size_2d, scatter_key, [&] ()
+   {
+      return get_scatter_draw (columns, projection, with_noise);
+   });
+
+   const bool with_sensitivity = option_panel.with_sensitivity ();
+   Dstring statistics_key = bg_key + ":" + columns_key + ":" + clusters_key +
+      Dstring::render (":%f:%d:%d:%d:%d:%d", predictor.temperature_925,
+      clusters.with_kde, with_outline, Integer (with_percentages),
+      option_panel.with_bootstrap (), bootstrap.number_of_replicates);
+   if (with_sensitivity) { statistics_key += ":" + sensitivity_key; }
+   for (Integer i = 0; i < clusters.size (); i++)
+   {
+      statistics_key += Dstring::render (":%f", clusters.at (i)->probability);
+   }
 
+   statistics_layer_stage.update (statistics_key);
+   statistics_layer.render (cr, size_2d, statistics_key,
+      [&] (const RefPtr<Context>& cr)
    {
+
+      for (Integer i = 0; i < clusters.size (); i++)
+      {
+         const Cluster& cluster = *(clusters.at (i));
+         const Wind& mean_wind = cluster.mean_wind;
+         const Real direction = mean_wind.get_direction ();
+         const Real speed = mean_wind.get_speed () / 0.5144444;
+         const Point_2D p = t.transform (Point_2D (direction, speed));
+         cr->save ();
+         Star (10).cairo (cr, p);
+         Color (i, 0.8).cairo (cr);
+         cr->fill_preserve ();
+         Color::black ().cairo (cr);
+         cr->stroke ();
+         cr->restore ();
+      }
+
+      if (with_outline) { wind_disc.render_percentage_d (cr, hue); }
+      if (with_percentages) { wind_disc.render_percentages (cr); }
+
+      render_histogram (cr, predictor);
+      if (with_sensitivity) { render_sensitivity (cr); }
+
       const Point_2D anchor (viewport.get_nw () + Index_2D (10, 10));
       const Integer day_of_year_threshold =
          option_panel.get_day_of_year_threshold ();
@@ -492,515 +716,2688 @@ Nine2five::render (const RefPtr<Context>& cr,
       Label (hour_str, anchor + Point_2D (0, 15), 'l', 't').cairo (
          cr, Color::gray (0.2, 0.7), Color::gray (0.8, 0.9), Point_2D (-3, 3));
       cr->restore ();
+
+   });
+
+   // the interactive overlay changes with nearly every event
+   if (option_panel.with_surface () && surface_ptr != nullptr &&
+       surface_key == get_surface_key (dtime, predictor))
+   {
+      Tuple level_tuple;
+      for (Real p = 0.25; p < 1; p += 0.25) { level_tuple.push_back (p); }
+      surface_ptr->render (cr, t, level_tuple);
    }
 
-   set_foreground_ready (false);
+   {
+      const Predictor::Sequence& sequence = sequence_map.at (station);
+      const Dtime& dtime = time_chooser.get_time ();
+      render_predictor (cr, sequence.at (dtime), false);
+   }
+   render_predictor (cr, predictor, true);
+
+   if (with_cluster) { clusters.render (cr, 0.4); }
+   clusters.render_defining (cr);
 
-   delete record_set_ptr;
+   // status and debug text is left out of saved images
+   if (!recording) { render_status (cr); }
 
+   set_foreground_ready (false);
 
 }
 
-Nine2five::Nine2five (Gtk::Window* window_ptr,
-                      const Size_2D& size_2d,
-                      const Predictor::Sequence::Map& sequence_map,
-                      const Data& data,
-                      Wind_Disc& wind_disc)
-   : Dcanvas (*window_ptr),
-     wind_disc (wind_disc),
-     window_ptr (window_ptr),
-     station_panel (*this, sequence_map.get_station_tokens (), 0, 6),
-     option_panel (*this),
-     time_chooser (*this, 12),
-     sequence_map (sequence_map),
-     station (sequence_map.get_station_tokens ().front ()),
-     data (data),
-     wind_925_threshold (5 * 0.514444),
-     predictor (Wind (GSL_NAN, GSL_NAN), GSL_NAN),
-     defining_predictor (false)
+Layer::Layer ()
+   : render_count (0)
 {
+}
 
-   // Snipplet Hint for year_round
-   //time_chooser.set_year_round ();
-   //set_station (station_tokens.front ());
+void
+Layer::clear ()
+{
+   surface = RefPtr<ImageSurface> ();
+   key = "";
+}
 
-   Gdk::EventMask event_mask = (Gdk::SCROLL_MASK);
-   event_mask |= (Gdk::POINTER_MOTION_MASK);
-   event_mask |= (Gdk::BUTTON_PRESS_MASK | Gdk::BUTTON_RELEASE_MASK);
-   event_mask |= (Gdk::KEY_PRESS_MASK | Gdk::KEY_RELEASE_MASK);
-   set_events (event_mask);
+void
+Layer::render (const RefPtr<Context>& cr,
+               const Size_2D& size_2d,
+               const Dstring& key,
+               const function<void (const RefPtr<Context>&)>& draw)
+{
 
-   // This basically sets the minimum size
-   set_size_request (size_2d.i, size_2d.j);
-   set_can_focus ();
+   if (cr->get_target ()->get_type () != SURFACE_TYPE_IMAGE)
+   {
+      draw (cr);
+      return;
+   }
 
-   time_chooser.get_signal ().connect (sigc::mem_fun (
-      *this, &Nine2five::update_predictor));
+   const bool resized = !surface ||
+      surface->get_width () != size_2d.i ||
+      surface->get_height () != size_2d.j;
 
-   register_widget (station_panel);
-   register_widget (option_panel);
-   register_widget (time_chooser);
+   if (resized || key != this->key)
+   {
+      if (resized)
+      {
+         surface = ImageSurface::create (FORMAT_ARGB32, size_2d.i, size_2d.j);
+      }
+      const RefPtr<Context> layer_cr = Context::create (surface);
+      layer_cr->set_operator (OPERATOR_CLEAR);
+      layer_cr->paint ();
+      layer_cr->set_operator (OPERATOR_OVER);
+      draw (layer_cr);
+      this->key = key;
+      render_count++;
+   }
 
-   set_preferred_size (size_2d.i, size_2d.j);
-   being_packed (Point_2D (0, 0), size_2d.i, size_2d.j);
+   cr->save ();
+   cr->set_source (surface, 0, 0);
+   cr->paint ();
+   cr->restore ();
 
-   set_station (sequence_map.get_station_tokens ().front ());
+}
 
-   pack ();
+Stage::Stage (const Dstring& name)
+   : name (name),
+     version (0),
+     recompute_count (0),
+     recomputed (false)
+{
+}
 
+bool
+Stage::update (const Dstring& key)
+{
+   if (key == this->key) { return false; }
+   this->key = key;
+   version++;
+   recompute_count++;
+   recomputed = true;
+   return true;
 }
 
-Nine2five::~Nine2five ()
+void
+Stage::invalidate ()
 {
+   key = "";
 }
 
-const Data&
-Nine2five::get_data () const
+Async_Layer::Async_Layer (const function<void ()>& on_ready)
+   : on_ready (on_ready),
+     generation (0),
+     shown_generation (0),
+     stopping (false),
+     pending (false),
+     pending_size_2d (0, 0),
+     pending_generation (0),
+     done_generation (0),
+     render_count (0),
+     discarded_count (0)
 {
-   return data;
+   dispatcher.connect (sigc::mem_fun (*this, &Async_Layer::on_done));
+   thread = std::thread (&Async_Layer::run, this);
+}
+
+Async_Layer::~Async_Layer ()
+{
+   {
+      std::lock_guard<std::mutex> lock (mutex);
+      stopping = true;
+   }
+   condition.notify_one ();
+   thread.join ();
 }
 
 void
-Nine2five::save_image ()
+Async_Layer::run ()
 {
 
-   using namespace Gtk;
+   while (true)
+   {
 
-   FileChooserDialog* dialog_ptr = new FileChooserDialog (
-      "Save Image...", FILE_CHOOSER_ACTION_SAVE);
+      Draw draw;
+      Size_2D size_2d (0, 0);
+      Integer g;
 
-   FileChooserDialog& dialog = *dialog_ptr;
-   dialog.set_transient_for (*window_ptr);
+      {
+         std::unique_lock<std::mutex> lock (mutex);
+         condition.wait (lock, [this] () { return stopping || pending; });
+         if (stopping) { return; }
+         draw = pending_draw;
+         size_2d = pending_size_2d;
+         g = pending_generation;
+         pending_draw = Draw ();
+         pending = false;
+      }
 
-   dialog.add_button (Stock::CANCEL, RESPONSE_CANCEL);
-   dialog.add_button (Stock::SAVE, RESPONSE_OK);
+      RefPtr<ImageSurface> surface = ImageSurface::create (
+         FORMAT_ARGB32, size_2d.i, size_2d.j);
+      draw (Context::create (surface));
 
-   Glib::RefPtr<Gtk::FileFilter> filter_png = Gtk::FileFilter::create ();
-   filter_png->set_name ("PNG Image Format (*.png)");
-   filter_png->add_mime_type ("image/png");
-   dialog.add_filter (filter_png);
+      {
+         std::lock_guard<std::mutex> lock (mutex);
+         done_surface = surface;
+         done_generation = g;
+      }
 
-   Glib::RefPtr<Gtk::FileFilter> filter_pdf = Gtk::FileFilter::create ();
-   filter_pdf->set_name ("PDF Format (*.pdf)");
-   filter_pdf->add_mime_type ("application/pdf");
-   dialog.add_filter (filter_pdf);
+      dispatcher.emit ();
 
-   Glib::RefPtr<Gtk::FileFilter> filter_svg = Gtk::FileFilter::create ();
-   filter_svg->set_name ("SVG Image Format (*.svg)");
-   filter_svg->add_mime_type ("image/svg");
-   dialog.add_filter (filter_svg);
+   }
 
-   int result = dialog.run ();
+}
+
+void
+Async_Layer::on_done ()
+{
 
-   switch (result)
    {
-      case RESPONSE_OK:
+      std::lock_guard<std::mutex> lock (mutex);
+      if (!done_surface || done_generation <= shown_generation) { return; }
+      const bool resized = !surface ||
+         done_surface->get_width () != surface->get_width () ||
+         done_surface->get_height () != surface->get_height ();
+      if (resized) { return; }
+      surface = done_surface;
+      shown_generation = done_generation;
+      done_surface = RefPtr<ImageSurface> ();
+      render_count++;
+   }
+
+   on_ready ();
+
+}
+
+void
+Async_Layer::render (const RefPtr<Context>& cr,
+                     const Size_2D& size_2d,
+                     const Dstring& key,
+                     const function<Draw ()>& snapshot)
+{
+
+   if (cr->get_target ()->get_type () != SURFACE_TYPE_IMAGE)
+   {
+      snapshot () (cr);
+      return;
+   }
+
+   const bool resized = !surface ||
+      surface->get_width () != size_2d.i ||
+      surface->get_height () != size_2d.j;
+
+   if (resized)
+   {
+      // with nothing of the right size to show, this frame waits
+      surface = ImageSurface::create (FORMAT_ARGB32, size_2d.i, size_2d.j);
+      snapshot () (Context::create (surface));
+      shown_generation = ++generation;
+      requested_key = key;
+      render_count++;
+   }
+   else
+   if (key != requested_key)
+   {
+      const Draw& draw = snapshot ();
+      {
+         std::lock_guard<std::mutex> lock (mutex);
+         if (pending) { discarded_count++; }
+         pending = true;
+         pending_draw = draw;
+         pending_size_2d = size_2d;
+         pending_generation = ++generation;
+      }
+      condition.notify_one ();
+      requested_key = key;
+   }
+
+   cr->save ();
+   cr->set_source (surface, 0, 0);
+   cr->paint ();
+   cr->restore ();
+
+}
+
+Playback::Playback (const Integer capacity,
+                    const Integer number_of_threads)
+   : ring (capacity),
+     front (0),
+     size (0),
+     generation (0),
+     busy_count (0),
+     stopping (false),
+     number_of_threads (number_of_threads)
+{
+}
+
+Playback::~Playback ()
+{
+   clear ();
+   {
+      std::lock_guard<std::mutex> lock (mutex);
+      stopping = true;
+   }
+   condition.notify_all ();
+   for (std::thread& thread : thread_tuple) { thread.join (); }
+}
+
+Integer
+Playback::get_next () const
+{
+   // the frame nearest the front that nobody has started on
+   for (Integer i = 0; i < size; i++)
+   {
+      const Integer k = (front + i) % ring.size ();
+      if (!ring[k].started) { return k; }
+   }
+   return -1;
+}
+
+void
+Playback::run ()
+{
+
+   // the frames already run side by side, so a job keeps its chunks
+   Chunks::set_number_of_threads (1);
+
+   while (true)
+   {
+
+      Job job;
+      Integer k;
+      Integer g;
+
       {
-         if (!save (dialog.get_filename ()))
+         std::unique_lock<std::mutex> lock (mutex);
+         condition.wait (lock, [this] () {
+            return stopping || get_next () >= 0; });
+         if (stopping) { return; }
+         k = get_next ();
+         ring[k].started = true;
+         job = ring[k].job;
+         g = generation;
+         busy_count++;
+      }
+
+      auto is_cancelled = [&] () { return generation != g; };
+      Record::Columns* columns_ptr = job (is_cancelled);
+
+      {
+         std::lock_guard<std::mutex> lock (mutex);
+         if (is_cancelled ()) { delete columns_ptr; }
+         else
          {
-            const Dstring str_a ("PNG, SVG, or PDF Formats Only");
-            const Dstring str_b ("Ensure your file name ends with .png, .svg, or .pdf. Abort.");
-            Gtk::MessageDialog* d_ptr = new Gtk::MessageDialog (*window_ptr, str_a);
-            d_ptr->set_secondary_text (str_b);
-            d_ptr->run ();
-            delete d_ptr;
-            delete dialog_ptr;
-            save_image ();
+            ring[k].columns_ptr = columns_ptr;
+            ring[k].done = true;
          }
-
-         break;
+         busy_count--;
       }
+
+      idle_condition.notify_all ();
+
    }
 
-   delete dialog_ptr;
+}
 
+bool
+Playback::is_full () const
+{
+   std::lock_guard<std::mutex> lock (mutex);
+   return size == ring.size ();
 }
 
 bool
-Nine2five::save (const Dstring& file_path)
+Playback::get_front (Dtime& dtime,
+                     Dstring& key) const
 {
+   std::lock_guard<std::mutex> lock (mutex);
+   if (size == 0) { return false; }
+   dtime = ring[front].dtime;
+   key = ring[front].key;
+   return true;
+}
 
-   const Size_2D& size_2d = get_size_2d ();
-   const Tokens tokens (file_path, ".");
+bool
+Playback::get_back (Dtime& dtime) const
+{
+   std::lock_guard<std::mutex> lock (mutex);
+   if (size == 0) { return false; }
+   dtime = ring[(front + size - 1) % ring.size ()].dtime;
+   return true;
+}
 
-   const Dstring& file_extension = tokens.back ();
+void
+Playback::push (const Dtime& dtime,
+                const Dstring& key,
+                const Job& job)
+{
 
-   if (file_extension == "png")
    {
-      RefPtr<ImageSurface> surface = Cairo::ImageSurface::create (
-         FORMAT_RGB24, size_2d.i, size_2d.j);
-      const RefPtr<Context> cr = Context::create (surface);
-      cairo (cr);
-      image_surface->write_to_png (file_path);
-      return true;
+      std::lock_guard<std::mutex> lock (mutex);
+      if (size == ring.size ()) { return; }
+      Slot& slot = ring[(front + size) % ring.size ()];
+      slot.dtime = dtime;
+      slot.key = key;
+      slot.job = job;
+      slot.columns_ptr = nullptr;
+      slot.started = false;
+      slot.done = false;
+      size++;
    }
-   else
-   if (file_extension == "pdf")
+
+   // nothing runs until something is first played
+   while (thread_tuple.size () < number_of_threads)
    {
-      RefPtr<PdfSurface> surface = Cairo::PdfSurface::create (
-         file_path, size_2d.i, size_2d.j);
-      const RefPtr<Context> cr = Context::create (surface);
-      cairo (cr);
-      return true;
+      thread_tuple.push_back (std::thread (&Playback::run, this));
    }
-   else
-   if (file_extension == "svg")
+
+   condition.notify_one ();
+
+}
+
+Record::Columns*
+Playback::pop ()
+{
+
+   std::lock_guard<std::mutex> lock (mutex);
+   if (size == 0 || !ring[front].done) { return nullptr; }
+
+   Slot& slot = ring[front];
+   Record::Columns* columns_ptr = slot.columns_ptr;
+   slot.columns_ptr = nullptr;
+   slot.job = Job ();
+   front = (front + 1) % ring.size ();
+   size--;
+   return columns_ptr;
+
+}
+
+void
+Playback::clear ()
+{
+
+   std::unique_lock<std::mutex> lock (mutex);
+   generation++;
+
+   for (Integer i = 0; i < size; i++)
    {
-      RefPtr<SvgSurface> surface = Cairo::SvgSurface::create (
-         file_path, size_2d.i, size_2d.j);
-      const RefPtr<Context> cr = Context::create (surface);
-      cairo (cr);
-      return true;
+      Slot& slot = ring[(front + i) % ring.size ()];
+      delete slot.columns_ptr;
+      slot.columns_ptr = nullptr;
+      slot.job = Job ();
    }
 
-   return false;
+   front = 0;
+   size = 0;
+
+   // the jobs read the archive, which may be rebuilt once this returns
+   idle_condition.wait (lock, [this] () { return busy_count == 0; });
+
+}
 
+Worker::Worker ()
+   : generation (0),
+     stopping (false)
+{
+   thread = std::thread (&Worker::run, this);
+}
+
+Worker::~Worker ()
+{
+   stop ();
 }
 
 void
-Nine2five::set_station (const Dstring& station)
+Worker::run ()
 {
-   this->station = station;
-   const Predictor::Sequence& sequence = sequence_map.at (station);
-   const set<Dtime>& time_set = sequence.get_time_set ();
-   const Time_Chooser::Shape time_chooser_shape (time_set);
-   time_chooser.set_shape (time_chooser_shape);
-   update_predictor ();
+
+   while (true)
+   {
+
+      Job job;
+      Integer g;
+
+      {
+         std::unique_lock<std::mutex> lock (mutex);
+         condition.wait (lock, [this] () {
+            return stopping || this->job != nullptr; });
+         if (stopping) { return; }
+         job = std::move (this->job);
+         this->job = nullptr;
+         g = generation;
+      }
+
+      job ([this, g] () { return generation != g; });
+
+   }
+
 }
 
-Record::Set*
-Nine2five::get_record_set_ptr (const Dtime& dtime,
-                               const Predictor& predictor)
+void
+Worker::post (const Job& job)
 {
 
-   const Integer day_of_year = stoi (dtime.get_string ("%j"));
-   const Integer hour = stoi (dtime.get_string ("%H"));
+   {
+      std::lock_guard<std::mutex> lock (mutex);
+      this->job = job;
+      generation++;
+   }
 
-   const Option_Panel& op = option_panel;
-   const Integer day_of_year_threshold = op.get_day_of_year_threshold ();
-   const Integer hour_threshold = op.get_hour_threshold ();
+   condition.notify_one ();
 
-   Station_Data& station_data = data.get_station_data (station);
+}
 
-   return station_data.get_record_set_ptr (day_of_year,
-      day_of_year_threshold, hour, hour_threshold,
-      predictor.wind_925, wind_925_threshold);
+void
+Worker::cancel ()
+{
+   std::lock_guard<std::mutex> lock (mutex);
+   job = nullptr;
+   generation++;
+}
+
+void
+Worker::stop ()
+{
+
+   {
+      std::lock_guard<std::mutex> lock (mutex);
+      job = nullptr;
+      generation++;
+      stopping = true;
+   }
+
+   condition.notify_one ();
+   if (thread.joinable ()) { thread.join (); }
 
 }
 
-bool
-Nine2five::on_key_pressed (const Dkey_Event& event)
+Exporter::Job::Job ()
+   : size_2d (0, 0),
+     scale (1)
 {
+}
 
-   if (Dcontainer::on_key_pressed (event)) { return true; }
+Exporter::Exporter (const function<void (const Dstring&)>& on_done)
+   : on_done (on_done),
+     stopping (false),
+     pending_count (0)
+{
+   dispatcher.connect (sigc::mem_fun (*this, &Exporter::on_dispatch));
+   thread = std::thread (&Exporter::run, this);
+}
 
-   switch (event.value)
+Exporter::~Exporter ()
+{
+   // files already asked for are still written
    {
+      std::lock_guard<std::mutex> lock (mutex);
+      stopping = true;
+   }
+   condition.notify_one ();
+   thread.join ();
+}
 
-      case GDK_KEY_Left:
-      {
-         time_chooser.step_backward ();
-         return true;
-      }
+void
+Exporter::run ()
+{
 
-      case GDK_KEY_Right:
-      {
-         time_chooser.step_forward ();
-         return true;
-      }
+   while (true)
+   {
 
-      case GDK_KEY_N:
-      case GDK_KEY_n:
-      {
-         option_panel.toggle_noise ();
-         return true;
-      }
+      Job job;
 
-      case GDK_KEY_O:
-      case GDK_KEY_o:
       {
-         option_panel.toggle_outline ();
-         return true;
+         std::unique_lock<std::mutex> lock (mutex);
+         condition.wait (lock, [this] () {
+            return stopping || !job_list.empty (); });
+         if (job_list.empty ()) { return; }
+         job = std::move (job_list.front ());
+         job_list.pop_front ();
       }
 
-      case GDK_KEY_P:
-      case GDK_KEY_p:
+      Dstring message;
+      try
       {
-         option_panel.toggle_percentages ();
-         return true;
+         write (job);
+         message = "Saved " + job.file_path;
       }
-
-      case GDK_KEY_C:
-      case GDK_KEY_c:
+      catch (const std::exception& e)
       {
-         option_panel.toggle_cluster ();
-         return true;
+         message = "Could not save " + job.file_path + ": " + e.what ();
       }
 
-      case GDK_KEY_Q:
-      case GDK_KEY_q:
+      // the recording is let go here, on the thread that last used it
+      job.recording = RefPtr<Surface> ();
+
       {
-         exit (0);
-         //delete window_ptr;
-         //delete this;
-         break;
+         std::lock_guard<std::mutex> lock (mutex);
+         message_tuple.push_back (message);
       }
 
-   }
+      dispatcher.emit ();
+
+   }
+
+}
+
+void
+Exporter::on_dispatch ()
+{
+
+   vector<Dstring> message_tuple;
+
+   {
+      std::lock_guard<std::mutex> lock (mutex);
+      message_tuple.swap (this->message_tuple);
+   }
+
+   for (const Dstring& message : message_tuple)
+   {
+      pending_count--;
+      on_done (message);
+   }
+
+}
+
+void
+Exporter::push (Job&& job)
+{
+
+   {
+      std::lock_guard<std::mutex> lock (mutex);
+      job_list.push_back (std::move (job));
+   }
+
+   pending_count++;
+   condition.notify_one ();
+
+}
+
+void
+Exporter::write (const Job& job)
+{
+
+   const Real scale = job.scale;
+   const Integer width = Integer (ceil (job.size_2d.i * scale));
+   const Integer height = Integer (ceil (job.size_2d.j * scale));
+   const Tokens tokens (job.file_path, ".");
+   const Dstring& file_extension = tokens.back ();
+
+   auto draw = [&job, scale] (const RefPtr<Context>& cr)
+   {
+      cr->scale (scale, scale);
+      cr->set_source (job.recording, 0, 0);
+      cr->paint ();
+   };
+
+   if (file_extension == "png")
+   {
+
+      RefPtr<ImageSurface> surface = ImageSurface::create (
+         FORMAT_RGB24, width, height);
+
+      // a recording may only be replayed by one thread at a time,
+      // so the whole image is drawn here on the export thread
+      draw (Context::create (surface));
+      surface->flush ();
+
+      surface->write_to_png (job.file_path);
+
+   }
+   else
+   if (file_extension == "pdf")
+   {
+      RefPtr<PdfSurface> surface = PdfSurface::create (
+         job.file_path, width, height);
+      draw (Context::create (surface));
+      surface->finish ();
+   }
+   else
+   if (file_extension == "svg")
+   {
+      RefPtr<SvgSurface> surface = SvgSurface::create (
+         job.file_path, width, height);
+      draw (Context::create (surface));
+      surface->finish ();
+   }
+
+}
+
+Scatter_Plot::Scatter_Plot (const Real ring_size)
+   : ring_size (ring_size),
+     mask_size (ceil (ring_size * 2) + 8)
+{
+
+   ring_mask = get_mask ([&] (const RefPtr<Context>& cr, const Point_2D& p)
+   {
+      Ring (ring_size).cairo (cr, p);
+      cr->fill ();
+   });
+
+   g_mask = get_mask ([&] (const RefPtr<Context>& cr, const Point_2D& p)
+   {
+      Label ("G", p, 'c', 'c').cairo (cr);
+   });
+
+}
+
+RefPtr<ImageSurface>
+Scatter_Plot::get_mask (const function<void (const RefPtr<Context>&,
+                                             const Point_2D&)>& draw) const
+{
+   const Integer n = Integer (mask_size);
+   const Point_2D centre (mask_size / 2, mask_size / 2);
+   RefPtr<ImageSurface> surface = ImageSurface::create (FORMAT_A8, n, n);
+   const RefPtr<Context> cr = Context::create (surface);
+   draw (cr, centre);
+   return surface;
+}
+
+Scatter_Plot::Snapshot::Snapshot (const Record::Columns& columns,
+                                  const Record::Projection& projection,
+                                  const vector<Integer>& index_tuple,
+                                  const bool with_noise,
+                                  const Integer max_dots)
+   : point_tuple (with_noise ?
+        projection.noisy_point_tuple : projection.point_tuple),
+     point_925_tuple (projection.point_925_tuple),
+     weight_tuple (columns.weight_tuple),
+     index_tuple (index_tuple),
+     max_dots (max_dots)
+{
+}
+
+void
+Scatter_Plot::render (const RefPtr<Context>& cr,
+                      const Snapshot& snapshot) const
+{
+
+   const vector<Point_2D>& point_tuple = snapshot.point_tuple;
+   const vector<Point_2D>& point_925_tuple = snapshot.point_925_tuple;
+   const Tuple& weight_tuple = snapshot.weight_tuple;
+   const vector<Integer>& index_tuple = snapshot.index_tuple;
+   const Integer max_dots = snapshot.max_dots;
+
+   const Integer n = point_tuple.size ();
+   const Real alpha = bound (50.0 / n, 0.45, 0.05);
+   const Real h = mask_size / 2;
+
+   // faint weighted analogs are left out of the plot
+   auto is_plotted = [&] (const Integer k)
+   {
+      return index_tuple[k] >= -1 && weight_tuple[k] >= 0.02;
+   };
+
+   Integer count = 0;
+   for (Integer k = 0; k < n; k++) { if (is_plotted (k)) { count++; } }
+
+   if (max_dots >= 0 && count > max_dots)
+   {
+      map<Integer, vector<Integer> > k_tuple_map;
+      for (Integer k = 0; k < n; k++)
+      {
+         if (is_plotted (k)) { k_tuple_map[index_tuple[k]].push_back (k); }
+      }
+      render_density (cr, point_tuple, weight_tuple, k_tuple_map);
+      return;
+   }
+
+   // records by cluster and by weight in sixteenths, one colour each
+   map<pair<Integer, Integer>, vector<Integer> > group_map;
+   for (Integer k = 0; k < n; k++)
+   {
+      if (!is_plotted (k)) { continue; }
+      const Integer i = index_tuple[k];
+      const Integer level = std::max (Integer (round (weight_tuple[k] * 16)), 1);
+      group_map[make_pair (i, level)].push_back (k);
+   }
+
+   // masks are bitmaps; anything but a screen image gets true paths
+   const bool vector_target = (cr->get_target ()->get_type () !=
+      SURFACE_TYPE_IMAGE);
+
+   cr->save ();
+   cr->set_line_width (0.5);
+   Dashes ("1:2").cairo (cr);
+
+   for (const auto& g : group_map)
+   {
+
+      const Integer i = g.first.first;
+      const Real a = alpha * g.first.second / 16;
+      const vector<Integer>& k_tuple = g.second;
+      const Color& color = (i < 0 ? Color::gray (0.5, a) : Color (i, a));
+      color.cairo (cr);
+
+      // stamps keep the alpha build-up of overlapping rings
+      for (const Integer k : k_tuple)
+      {
+         const Point_2D& p = point_tuple[k];
+         const Point_2D& p_gw = point_925_tuple[k];
+         if (vector_target)
+         {
+            Ring (ring_size).cairo (cr, p);
+            cr->fill ();
+            Label ("G", p_gw, 'c', 'c').cairo (cr);
+         }
+         else
+         {
+            cr->mask (ring_mask, p.x - h, p.y - h);
+            cr->mask (g_mask, p_gw.x - h, p_gw.y - h);
+         }
+      }
+
+      for (const Integer k : k_tuple)
+      {
+         const Point_2D& p = point_tuple[k];
+         const Point_2D& p_gw = point_925_tuple[k];
+         cr->move_to (p.x, p.y);
+         cr->line_to (p_gw.x, p_gw.y);
+      }
+      cr->stroke ();
+
+   }
+
+   cr->restore ();
+
+}
+
+void
+Scatter_Plot::render_density (const RefPtr<Context>& cr,
+                              const vector<Point_2D>& point_tuple,
+                              const Tuple& weight_tuple,
+                              const map<Integer, vector<Integer> >& k_tuple_map) const
+{
+
+   Real x_0 = GSL_POSINF, y_0 = GSL_POSINF;
+   Real x_1 = GSL_NEGINF, y_1 = GSL_NEGINF;
+   for (const auto& i : k_tuple_map)
+   {
+      for (const Integer k : i.second)
+      {
+         const Point_2D& p = point_tuple[k];
+         x_0 = std::min (x_0, p.x);
+         y_0 = std::min (y_0, p.y);
+         x_1 = std::max (x_1, p.x);
+         y_1 = std::max (y_1, p.y);
+      }
+   }
+   if (!(x_1 >= x_0 && y_1 >= y_0)) { return; }
+
+   // the cell count is fixed, not the cell size, so the cost does not
+   // grow with the window; one cell of margin all round
+   const Integer m = 160;
+   const Real cell = std::max (std::max (x_1 - x_0, y_1 - y_0) / m, 1.0);
+   const Real origin_x = x_0 - cell;
+   const Real origin_y = y_0 - cell;
+   const Integer ni = Integer ((x_1 - x_0) / cell) + 3;
+   const Integer nj = Integer ((y_1 - y_0) / cell) + 3;
+
+   Real max_density = 0;
+   map<Integer, Tuple> density_map;
+
+   for (const auto& i : k_tuple_map)
+   {
+      Tuple& density_tuple = density_map[i.first];
+      density_tuple.resize (ni * nj, 0);
+      for (const Integer k : i.second)
+      {
+         const Point_2D& p = point_tuple[k];
+         const Integer ci = Integer ((p.x - origin_x) / cell);
+         const Integer cj = Integer ((p.y - origin_y) / cell);
+         Real& density = density_tuple[cj * ni + ci];
+         density += weight_tuple[k];
+         max_density = std::max (max_density, density);
+      }
+   }
+
+   const Real log_max = log1p (max_density);
+   const bool vector_target = (cr->get_target ()->get_type () !=
+      SURFACE_TYPE_IMAGE);
+
+   for (const auto& d : density_map)
+   {
+
+      const Integer i = d.first;
+      const Tuple& density_tuple = d.second;
+
+      // one filled cell each, so that saved documents stay vector
+      if (vector_target)
+      {
+         for (Integer cj = 0; cj < nj; cj++)
+         {
+            for (Integer ci = 0; ci < ni; ci++)
+            {
+               const Real density = density_tuple[cj * ni + ci];
+               if (!(density > 0)) { continue; }
+               const Real a = log1p (density) / log_max * 0.8;
+               const Point_2D corner (origin_x + ci * cell, origin_y + cj * cell);
+               (i < 0 ? Color::gray (0.5, a) : Color (i, a)).cairo (cr);
+               Rect (corner, cell, cell).cairo (cr);
+               cr->fill ();
+            }
+         }
+         continue;
+      }
+
+      RefPtr<ImageSurface> surface = ImageSurface::create (FORMAT_A8, ni, nj);
+      unsigned char* data = surface->get_data ();
+      const Integer stride = surface->get_stride ();
+      for (Integer cj = 0; cj < nj; cj++)
+      {
+         for (Integer ci = 0; ci < ni; ci++)
+         {
+            const Real f = log1p (density_tuple[cj * ni + ci]) / log_max;
+            data[cj * stride + ci] = (unsigned char) (round (f * 0.8 * 255));
+         }
+      }
+      surface->mark_dirty ();
+
+      // the mask is smoothed as it is scaled up to the screen
+      cr->save ();
+      const Color& color = (i < 0 ? Color::gray (0.5, 1) : Color (i, 1));
+      color.cairo (cr);
+      cr->translate (origin_x, origin_y);
+      cr->scale (cell, cell);
+      cr->mask (surface, 0, 0);
+      cr->restore ();
+
+   }
+
+}
+
+void
+Scatter_Plot::benchmark (const Wind_Disc::Transform& transform,
+                         const Size_2D& size_2d)
+{
+
+   const Scatter_Plot scatter_plot;
+   const Integer number_of_frames = 10;
+   mt19937_64 engine (925);
+   normal_distribution<Real> gaussian (0, 6);
+
+   RefPtr<ImageSurface> surface = ImageSurface::create (
+      FORMAT_ARGB32, size_2d.i, size_2d.j);
+   const RefPtr<Context> cr = Context::create (surface);
+
+   cout << "# scatter layer only: snapshot, draw and flush of one frame" << endl;
+   cout << "records dots_ms/frame density_ms/frame" << endl;
+
+   for (Integer n = 1000; n <= 64000; n *= 2)
+   {
+
+      Record::Columns columns;
+      for (Integer k = 0; k < n; k++)
+      {
+         const Wind wind_925 (gaussian (engine), gaussian (engine));
+         const Wind wind (gaussian (engine) / 2, gaussian (engine) / 2);
+         columns.add (Record (Dtime (k), wind_925, 15, wind));
+      }
+
+      Record::Projection projection (5);
+      projection.project (columns, transform);
+      const vector<Integer> index_tuple (n, -1);
+
+      cout << n;
+      for (const Integer max_dots : { -1, 0 })
+      {
+         const auto start = chrono::steady_clock::now ();
+         for (Integer f = 0; f < number_of_frames; f++)
+         {
+            cr->save ();
+            cr->set_operator (OPERATOR_CLEAR);
+            cr->paint ();
+            cr->restore ();
+            const Scatter_Plot::Snapshot snapshot (columns, projection,
+               index_tuple, false, max_dots);
+            scatter_plot.render (cr, snapshot);
+            surface->flush ();
+         }
+         const chrono::duration<Real, milli> elapsed =
+            chrono::steady_clock::now () - start;
+         cout << " " << elapsed.count () / number_of_frames;
+      }
+      cout << endl;
+
+   }
+
+}
+
+Nine2five::Nine2five (Gtk::Window* window_ptr,
+                      const Size_2D& size_2d,
+                      const Predictor::Sequence::Map& sequence_map,
+                      const Data& data,
+                      Wind_Disc& wind_disc)
+   : Dcanvas (*window_ptr),
+     wind_disc (wind_disc),
+     window_ptr (window_ptr),
+     station_panel (*this, sequence_map.get_station_tokens (), 0, 6),
+     option_panel (*this),
+     time_chooser (*this, 12),
+     sequence_map (sequence_map),
+     station (sequence_map.get_station_tokens ().front ()),
+     data (data),
+     wind_925_threshold (5 * 0.514444),
+     predictor (Wind (GSL_NAN, GSL_NAN), GSL_NAN),
+     defining_predictor (false),
+     columns_ptr (nullptr),
+     pending_columns_ptr (nullptr),
+     query_generation (0),
+     prefetch_generation (0),
+     prefetch_stopping (false),
+     projection (5),
+     histogram (1, 0.5),
+     summarized (false),
+     grouped (false),
+     surface_ptr (nullptr),
+     pending_surface_ptr (nullptr),
+     summary_version (0),
+     scatter_layer ([this] () { render_queue_draw (); }),
+     frame_tick_id (0),
+     event_count (0),
+     merged_count (0),
+     dropped_count (0),
+     frame_count (0),
+     with_frame_stats (false),
+     snapshot_stage ("snapshot"),
+     query_stage ("query"),
+     projection_stage ("projection"),
+     clusters_stage ("clusters"),
+     statistics_stage ("statistics"),
+     disc_layer_stage ("disc layer"),
+     scatter_layer_stage ("scatter layer"),
+     statistics_layer_stage ("statistics layer"),
+     with_pipeline_view (false),
+     playback (8, std::max (
+        Integer (std::thread::hardware_concurrency ()) / 2, 2)),
+     stall_count (0),
+     export_count (0),
+     exporter ([this] (const Dstring& message) { on_export_done (message); }),
+     recording (false)
+{
+
+   // Snipplet Hint for year_round
+   //time_chooser.set_year_round ();
+   //set_station (station_tokens.front ());
+
+   Gdk::EventMask event_mask = (Gdk::SCROLL_MASK);
+   event_mask |= (Gdk::POINTER_MOTION_MASK);
+   event_mask |= (Gdk::BUTTON_PRESS_MASK | Gdk::BUTTON_RELEASE_MASK);
+   event_mask |= (Gdk::KEY_PRESS_MASK | Gdk::KEY_RELEASE_MASK);
+   set_events (event_mask);
+
+   // This basically sets the minimum size
+   set_size_request (size_2d.i, size_2d.j);
+   set_can_focus ();
+
+   stage_ptr_tuple.push_back (&snapshot_stage);
+   stage_ptr_tuple.push_back (&query_stage);
+   stage_ptr_tuple.push_back (&projection_stage);
+   stage_ptr_tuple.push_back (&clusters_stage);
+   stage_ptr_tuple.push_back (&statistics_stage);
+   stage_ptr_tuple.push_back (&disc_layer_stage);
+   stage_ptr_tuple.push_back (&scatter_layer_stage);
+   stage_ptr_tuple.push_back (&statistics_layer_stage);
+
+   time_chooser.get_signal ().connect (sigc::mem_fun (
+      *this, &Nine2five::update_predictor));
+   bootstrap_dispatcher.connect (sigc::mem_fun (
+      *this, &Nine2five::on_bootstrap_ready));
+   sensitivity_dispatcher.connect (sigc::mem_fun (
+      *this, &Nine2five::on_sensitivity_ready));
+   surface_dispatcher.connect (sigc::mem_fun (
+      *this, &Nine2five::on_surface_ready));
+   query_dispatcher.connect (sigc::mem_fun (
+      *this, &Nine2five::on_query_ready));
+   prefetch_dispatcher.connect (sigc::mem_fun (
+      *this, &Nine2five::on_prefetch_ready));
+   prefetch_thread = std::thread (&Nine2five::run_prefetch, this);
+
+   register_widget (station_panel);
+   register_widget (option_panel);
+   register_widget (time_chooser);
+
+   set_preferred_size (size_2d.i, size_2d.j);
+   being_packed (Point_2D (0, 0), size_2d.i, size_2d.j);
+
+   set_station (sequence_map.get_station_tokens ().front ());
+
+   pack ();
+
+}
+
+Nine2five::~Nine2five ()
+{
+   if (frame_tick_id != 0) { remove_tick_callback (frame_tick_id); }
+   play_connection.disconnect ();
+   message_connection.disconnect ();
+   cancel_queries ();
+   playback.clear ();
+   {
+      std::lock_guard<std::mutex> lock (prefetch_mutex);
+      prefetch_stopping = true;
+   }
+   prefetch_condition.notify_one ();
+   prefetch_thread.join ();
+   delete pending_columns_ptr;
+   for (auto& i : prefetch_map) { delete i.second; }
+   for (Prefetched& prefetched : prefetched_tuple)
+   {
+      delete prefetched.columns_ptr;
+      delete prefetched.station_data_ptr;
+   }
+   bootstrap_worker.stop ();
+   sensitivity_worker.stop ();
+   surface_worker.stop ();
+   delete pending_surface_ptr;
+   delete surface_ptr;
+   delete columns_ptr;
+}
+
+const Data&
+Nine2five::get_data () const
+{
+   return data;
+}
+
+void
+Nine2five::save_image ()
+{
+
+   using namespace Gtk;
+
+   FileChooserDialog* dialog_ptr = new FileChooserDialog (
+      "Save Image...", FILE_CHOOSER_ACTION_SAVE);
+
+   FileChooserDialog& dialog = *dialog_ptr;
+   dialog.set_transient_for (*window_ptr);
+
+   dialog.add_button (Stock::CANCEL, RESPONSE_CANCEL);
+   dialog.add_button (Stock::SAVE, RESPONSE_OK);
+
+   Glib::RefPtr<Gtk::FileFilter> filter_png = Gtk::FileFilter::create ();
+   filter_png->set_name ("PNG Image Format (*.png)");
+   filter_png->add_mime_type ("image/png");
+   dialog.add_filter (filter_png);
+
+   Glib::RefPtr<Gtk::FileFilter> filter_pdf = Gtk::FileFilter::create ();
+   filter_pdf->set_name ("PDF Format (*.pdf)");
+   filter_pdf->add_mime_type ("application/pdf");
+   dialog.add_filter (filter_pdf);
+
+   Glib::RefPtr<Gtk::FileFilter> filter_svg = Gtk::FileFilter::create ();
+   filter_svg->set_name ("SVG Image Format (*.svg)");
+   filter_svg->add_mime_type ("image/svg");
+   dialog.add_filter (filter_svg);
+
+   int result = dialog.run ();
+
+   switch (result)
+   {
+      case RESPONSE_OK:
+      {
+         const Real scale = option_panel.get_export_scale ();
+         if (!save (dialog.get_filename (), scale))
+         {
+            const Dstring str_a ("PNG, SVG, or PDF Formats Only");
+            const Dstring str_b ("Ensure your file name ends with .png, .svg, or .pdf. Abort.");
+            Gtk::MessageDialog* d_ptr = new Gtk::MessageDialog (*window_ptr, str_a);
+            d_ptr->set_secondary_text (str_b);
+            d_ptr->run ();
+            delete d_ptr;
+            delete dialog_ptr;
+            save_image ();
+         }
+
+         break;
+      }
+   }
+
+   delete dialog_ptr;
+
+}
+
+bool
+Nine2five::save (const Dstring& file_path,
+                 const Real scale)
+{
+
+   const Tokens tokens (file_path, ".");
+   const Dstring& file_extension = tokens.back ();
+
+   if (file_extension != "png" && file_extension != "pdf" &&
+       file_extension != "svg")
+   {
+      return false;
+   }
+
+   // only the recording is made here; the file is written on the worker
+   Exporter::Job job;
+   job.recording = record ();
+   job.size_2d = get_size_2d ();
+   job.file_path = file_path;
+   job.scale = scale;
+   exporter.push (std::move (job));
+
+   render_queue_draw ();
+   return true;
+
+}
+
+RefPtr<Surface>
+Nine2five::record ()
+{
+
+   // a recording is not an image target, so every layer draws itself
+   // in full, as vectors, and can be played back at any scale
+   const Size_2D& size_2d = get_size_2d ();
+   const cairo_rectangle_t extents = { 0, 0, Real (size_2d.i), Real (size_2d.j) };
+   RefPtr<Surface> surface (new Surface (cairo_recording_surface_create (
+      CAIRO_CONTENT_COLOR_ALPHA, &extents), true));
+
+   const RefPtr<Context> cr = Context::create (surface);
+   recording = true;
+   cairo (cr);
+   recording = false;
+   return surface;
+
+}
+
+void
+Nine2five::on_export_done (const Dstring& message)
+{
+   export_message = message;
+   message_connection.disconnect ();
+   message_connection = Glib::signal_timeout ().connect (sigc::mem_fun (
+      *this, &Nine2five::clear_export_message), 4000);
+   render_queue_draw ();
+}
+
+bool
+Nine2five::clear_export_message ()
+{
+   export_message = "";
+   render_queue_draw ();
+   return false;
+}
+
+void
+Nine2five::set_station (const Dstring& station)
+{
+   this->station = station;
+   const Predictor::Sequence& sequence = sequence_map.at (station);
+   const set<Dtime>& time_set = sequence.get_time_set ();
+   const Time_Chooser::Shape time_chooser_shape (time_set);
+   time_chooser.set_shape (time_chooser_shape);
+   update_predictor ();
+}
+
+Record::Set*
+Nine2five::get_record_set_ptr (const Dtime& dtime,
+                               const Predictor& predictor)
+{
+
+   const Integer day_of_year = stoi (dtime.get_string ("%j"));
+   const Integer hour = stoi (dtime.get_string ("%H"));
+
+   const Option_Panel& op = option_panel;
+   const Integer day_of_year_threshold = op.get_day_of_year_threshold ();
+   const Integer hour_threshold = op.get_hour_threshold ();
+
+   Station_Data& station_data = data.get_station_data (station);
+
+   return station_data.get_record_set_ptr (day_of_year,
+      day_of_year_threshold, hour, hour_threshold,
+      predictor.wind_925, wind_925_threshold);
+
+}
+
+Dstring
+Nine2five::get_columns_key (const Dstring& station,
+                            const Dtime& dtime,
+                            const Predictor& predictor) const
+{
+   const Option_Panel& op = option_panel;
+   const Wind& w = predictor.wind_925;
+   return Dstring::render ("%s:%s:%d:%d:%f:%f:%f:%d:%d",
+      station.c_str (), dtime.get_string ("%j:%H").c_str (),
+      op.get_day_of_year_threshold (), op.get_hour_threshold (),
+      w.get_direction (), w.get_speed (), wind_925_threshold,
+      op.with_weighted_analogs (), op.get_trajectory_hours ());
+}
+
+Nine2five::Query
+Nine2five::get_query (const Dtime& dtime,
+                      const Predictor& predictor)
+{
+
+   const Option_Panel& op = option_panel;
+   const Wind& w = predictor.wind_925;
+   const bool weighted = op.with_weighted_analogs ();
+   const Integer trajectory_hours = op.get_trajectory_hours ();
+   const Integer day_of_year = stoi (dtime.get_string ("%j"));
+   const Integer hour = stoi (dtime.get_string ("%H"));
+   const Integer day_of_year_threshold = op.get_day_of_year_threshold ();
+   const Integer hour_threshold = op.get_hour_threshold ();
+   const Real wind_925_threshold = this->wind_925_threshold;
+   const Real threshold = wind_925_threshold / 0.51444444;
+
+   // trajectories fall back to the plain match when the predictor
+   // sequence does not reach back far enough, or no archive window does
+   Tuple u_tuple, v_tuple;
+   const bool trajectory = (trajectory_hours > 0) &&
+      get_trajectory_index (trajectory_hours).size () > 0 && get_trajectory (
+      u_tuple, v_tuple, dtime, predictor,
+      get_trajectory_index (trajectory_hours).get_lag_tuple ());
+
+   // the archive and index are built here, the worker only reads them
+   // and keeps them alive until it is done
+   if (trajectory) { get_trajectory_index (trajectory_hours); }
+   else if (weighted) { get_archive (); }
+   const shared_ptr<const Archive> a_ptr = (trajectory || weighted ?
+      archive_ptr : nullptr);
+   const shared_ptr<const Trajectory_Index> ti_ptr = (trajectory ?
+      trajectory_index_ptr : nullptr);
+
+   return [=] (const Station_Data& station_data,
+               const function<bool ()>& is_cancelled)
+   {
+
+      // a cancelled scan is not copied out; the caller throws it away
+      auto cancelled = [&] () { return is_cancelled && is_cancelled (); };
+
+      if (trajectory)
+      {
+         const Tuple& weight_tuple = ti_ptr->get_weight_tuple (
+            u_tuple, v_tuple, threshold, day_of_year, day_of_year_threshold,
+            hour, hour_threshold, is_cancelled);
+         if (cancelled ()) { return new Record::Columns (); }
+         return new Record::Columns (*a_ptr, weight_tuple, 0.5);
+      }
+
+      if (weighted)
+      {
+         // every record of the station, weighted on how close it is
+         const Real hour_scale = std::max (Real (hour_threshold), 0.5);
+         const Tuple& weight_tuple = a_ptr->get_weight_tuple (day_of_year,
+            day_of_year_threshold, hour, hour_scale, w, threshold,
+            Extra_Schema::Query (), is_cancelled);
+         if (cancelled ()) { return new Record::Columns (); }
+         return new Record::Columns (*a_ptr, weight_tuple, 1e-4);
+      }
+
+      const Record::Set* record_set_ptr = station_data.get_record_set_ptr (
+         day_of_year, day_of_year_threshold, hour, hour_threshold,
+         w, wind_925_threshold, Extra_Schema::Query (), is_cancelled);
+      Record::Columns* columns_ptr = new Record::Columns (*record_set_ptr);
+      delete record_set_ptr;
+      return columns_ptr;
+
+   };
+
+}
+
+void
+Nine2five::cancel_queries ()
+{
+   query_generation++;
+   prefetch_generation++;
+   if (query_thread.joinable ()) { query_thread.join (); }
+}
+
+const Record::Columns&
+Nine2five::get_columns (const Dtime& dtime,
+                        const Predictor& predictor)
+{
+
+   const Dstring& key = get_columns_key (station, dtime, predictor);
+
+   // the cached set is what lets clusters be updated incrementally, and
+   // the last finished one is shown while a newer one is worked out
+   if (columns_ptr != nullptr && key == columns_key)
+   {
+      // back where we were: whatever is in flight is no longer wanted
+      if (query_key != key)
+      {
+         query_key = key;
+         query_generation++;
+      }
+      return *columns_ptr;
+   }
+
+   if (columns_ptr != nullptr && key == query_key) { return *columns_ptr; }
+
+   // a newer query cancels the one in flight, the prefetch and the
+   // frames queued for playback
+   query_key = key;
+   cancel_queries ();
+   playback.clear ();
+   const Integer generation = query_generation;
+
+   auto iterator = prefetch_map.find (key);
+   if (iterator != prefetch_map.end ())
+   {
+      set_columns (iterator->second, key);
+      prefetch_map.erase (iterator);
+      prefetch ();
+      return *columns_ptr;
+   }
+
+   const Query& query = get_query (dtime, predictor);
+   const Station_Data& station_data = data.get_station_data (station);
+
+   // with nothing to show yet the first query is waited for
+   if (columns_ptr == nullptr)
+   {
+      set_columns (query (station_data, nullptr), key);
+      prefetch ();
+      return *columns_ptr;
+   }
+
+   query_thread = std::thread ([this, query, &station_data, generation, key] ()
+   {
+
+      auto is_cancelled = [&] () { return query_generation != generation; };
+      Record::Columns* columns_ptr = query (station_data, is_cancelled);
+      if (is_cancelled ()) { delete columns_ptr; return; }
+
+      {
+         std::lock_guard<std::mutex> lock (query_mutex);
+         delete pending_columns_ptr;
+         pending_columns_ptr = columns_ptr;
+         pending_columns_key = key;
+      }
+
+      query_dispatcher.emit ();
+
+   });
+
+   return *columns_ptr;
+
+}
+
+void
+Nine2five::prefetch ()
+{
+
+   const Option_Panel& op = option_panel;
+   const bool auto_925_wind = op.auto_925_wind ();
+   const Dtime& dtime = time_chooser.get_time ();
+
+   // the times either side, then the stations either side in panel
+   // order; other stations need their own archive when not plain
+   vector<pair<Dstring, Dtime> > target_tuple;
+   const Predictor::Sequence& sequence = sequence_map.at (station);
+   auto iterator = sequence.find (dtime);
+   if (iterator != sequence.end ())
+   {
+      auto next = std::next (iterator);
+      if (next != sequence.end ()) { target_tuple.push_back (make_pair (station, next->first)); }
+      if (iterator != sequence.begin ())
+      {
+         target_tuple.push_back (make_pair (station, std::prev (iterator)->first));
+      }
+   }
+
+   const Tokens& station_tokens = sequence_map.get_station_tokens ();
+   const Integer ns = station_tokens.size ();
+   const auto s = std::find (station_tokens.begin (), station_tokens.end (), station);
+   const bool plain = !op.with_weighted_analogs () && op.get_trajectory_hours () == 0;
+   if (plain && s != station_tokens.end () && ns > 1)
+   {
+      const Integer i = std::distance (station_tokens.begin (), s);
+      for (const Integer d : { 1, -1 })
+      {
+         const Dstring& neighbour = station_tokens[(i + d + ns) % ns];
+         const Predictor::Sequence& sequence = sequence_map.at (neighbour);
+         if (sequence.find (dtime) == sequence.end ()) { continue; }
+         target_tuple.push_back (make_pair (neighbour, dtime));
+      }
+   }
+
+   list<Prefetch_Job> job_list;
+   set<Dstring> key_set;
+
+   // a station already being read is not read a second time
+   set<Dstring> read_set;
+   {
+      std::lock_guard<std::mutex> lock (prefetch_mutex);
+      read_set = prefetch_read_set;
+   }
+
+   for (const auto& target : target_tuple)
+   {
+      const Dstring& s = target.first;
+      const Dtime& t = target.second;
+      const Predictor& p = (auto_925_wind ? sequence_map.at (s).at (t) : predictor);
+      const Dstring& key = get_columns_key (s, t, p);
+      if (!key_set.insert (key).second || key == columns_key) { continue; }
+      if (prefetch_map.find (key) != prefetch_map.end ()) { continue; }
+      auto d = data.find (s);
+      const Station_Data* sd_ptr = (d == data.end () ? nullptr : &d->second);
+      if (sd_ptr == nullptr && read_set.count (s) > 0) { continue; }
+      job_list.push_back (Prefetch_Job { key, s, get_query (t, p), sd_ptr });
+   }
+
+   // only the neighbours of where we are now are worth keeping
+   for (auto i = prefetch_map.begin (); i != prefetch_map.end (); )
+   {
+      if (key_set.count (i->first) > 0) { i++; continue; }
+      delete i->second;
+      i = prefetch_map.erase (i);
+   }
+
+   // jobs not started yet are replaced; the one in flight is cancelled
+   // by the generation, and nothing here waits for it
+   {
+      std::lock_guard<std::mutex> lock (prefetch_mutex);
+      prefetch_generation++;
+      prefetch_job_list.swap (job_list);
+   }
+
+   prefetch_condition.notify_one ();
+
+}
+
+void
+Nine2five::run_prefetch ()
+{
+
+   while (true)
+   {
+
+      Prefetch_Job job;
+      Integer generation;
+
+      {
+         std::unique_lock<std::mutex> lock (prefetch_mutex);
+         prefetch_condition.wait (lock, [this] () {
+            return prefetch_stopping || !prefetch_job_list.empty (); });
+         if (prefetch_stopping) { return; }
+         job = prefetch_job_list.front ();
+         prefetch_job_list.pop_front ();
+         generation = prefetch_generation;
+      }
+
+      // a station file is read in full even when the job is superseded,
+      // as it is kept anyway; only shutting down stops a read
+      Station_Data* read_ptr = nullptr;
+      const Station_Data* sd_ptr = job.station_data_ptr;
+      if (sd_ptr == nullptr)
+      {
+         {
+            std::lock_guard<std::mutex> lock (prefetch_mutex);
+            prefetch_read_set.insert (job.station);
+         }
+         read_ptr = new Station_Data ();
+         read_ptr->read (data.get_file_path (job.station),
+            [this] () { return bool (prefetch_stopping); });
+         if (prefetch_stopping) { delete read_ptr; return; }
+         sd_ptr = read_ptr;
+      }
+
+      auto is_cancelled = [&] () { return prefetch_generation != generation; };
+      Record::Columns* columns_ptr = job.query (*sd_ptr, is_cancelled);
+      if (is_cancelled ())
+      {
+         delete columns_ptr;
+         columns_ptr = nullptr;
+      }
+
+      if (columns_ptr == nullptr && read_ptr == nullptr) { continue; }
+
+      {
+         std::lock_guard<std::mutex> lock (prefetch_mutex);
+         prefetched_tuple.push_back (Prefetched { job.key, job.station,
+            columns_ptr, read_ptr });
+      }
+
+      prefetch_dispatcher.emit ();
+
+   }
+
+}
+
+void
+Nine2five::on_prefetch_ready ()
+{
+
+   std::lock_guard<std::mutex> lock (prefetch_mutex);
+
+   for (Prefetched& prefetched : prefetched_tuple)
+   {
+      if (prefetched.station_data_ptr != nullptr)
+      {
+         data.add_station_data (prefetched.station,
+            *prefetched.station_data_ptr);
+         delete prefetched.station_data_ptr;
+         prefetch_read_set.erase (prefetched.station);
+      }
+      if (prefetched.columns_ptr == nullptr) { continue; }
+      auto iterator = prefetch_map.find (prefetched.key);
+      if (iterator != prefetch_map.end ()) { delete iterator->second; }
+      prefetch_map[prefetched.key] = prefetched.columns_ptr;
+   }
+
+   prefetched_tuple.clear ();
+
+}
+
+void
+Nine2five::set_columns (Record::Columns* columns_ptr,
+                        const Dstring& key)
+{
+   delete this->columns_ptr;
+   clusters.reset ();
+   projection.clear ();
+   bootstrap.clear ();
+   bootstrap_key = "";
+   this->columns_ptr = columns_ptr;
+   columns_key = key;
+   summarized = false;
+   grouped = false;
+}
+
+void
+Nine2five::on_query_ready ()
+{
+
+   // a result is only taken for the state shown now, not merely for the
+   // last request made; anything else has the next frame ask again
+   const Dtime& dtime = time_chooser.get_time ();
+   const Dstring& key = get_columns_key (station, dtime, predictor);
+
+   {
+      std::lock_guard<std::mutex> lock (query_mutex);
+      if (pending_columns_ptr == nullptr) { return; }
+      if (pending_columns_key == query_key && pending_columns_key == key)
+      {
+         set_columns (pending_columns_ptr, pending_columns_key);
+      }
+      else
+      {
+         delete pending_columns_ptr;
+         snapshot_stage.invalidate ();
+      }
+      pending_columns_ptr = nullptr;
+   }
+
+   prefetch ();
+   render_queue_draw ();
+
+}
+
+bool
+Nine2five::on_key_pressed (const Dkey_Event& event)
+{
+
+   if (Dcontainer::on_key_pressed (event)) { return true; }
+
+   switch (event.value)
+   {
+
+      case GDK_KEY_Left:
+      {
+         time_chooser.step_backward ();
+         return true;
+      }
+
+      case GDK_KEY_Right:
+      {
+         time_chooser.step_forward ();
+         return true;
+      }
+
+      case GDK_KEY_N:
+      case GDK_KEY_n:
+      {
+         option_panel.toggle_noise ();
+         return true;
+      }
+
+      case GDK_KEY_O:
+      case GDK_KEY_o:
+      {
+         option_panel.toggle_outline ();
+         return true;
+      }
+
+      case GDK_KEY_P:
+      case GDK_KEY_p:
+      {
+         option_panel.toggle_percentages ();
+         return true;
+      }
+
+      case GDK_KEY_C:
+      case GDK_KEY_c:
+      {
+         option_panel.toggle_cluster ();
+         return true;
+      }
+
+      case GDK_KEY_F:
+      case GDK_KEY_f:
+      {
+         with_frame_stats = !with_frame_stats;
+         render_queue_draw ();
+         return true;
+      }
+
+      case GDK_KEY_space:
+      {
+         option_panel.toggle_play ();
+         return true;
+      }
+
+      case GDK_KEY_D:
+      case GDK_KEY_d:
+      {
+         with_pipeline_view = !with_pipeline_view;
+         render_queue_draw ();
+         return true;
+      }
+
+      case GDK_KEY_Q:
+      case GDK_KEY_q:
+      {
+         exit (0);
+         //delete window_ptr;
+         //delete this;
+         break;
+      }
+
+   }
+
+   return false;
+
+}
+
+bool
+Nine2five::on_mouse_button_pressed (const Dmouse_Button_Event& event)
+{
+
+   if (Dcontainer::on_mouse_button_pressed (event)) { return true; }
+   const Point_2D& point = event.point;
+
+   const Wind_Disc::Transform& transform = wind_disc.get_transform ();
+   const Wind& w = transform.get_wind (point);
+   const bool no_wind_925 = predictor.wind_925.is_naw ();
+   const Real difference = (w - predictor.wind_925).get_speed ();
+   const bool near_wind_925 = (difference <= wind_925_threshold);
+   const bool double_click = (event.type == GDK_2BUTTON_PRESS);
+   const bool triple_click = (event.type == GDK_3BUTTON_PRESS);
+
+   //if (near_wind_925 || (no_wind_925 && double_click))
+   if (near_wind_925)
+   {
+
+      if (double_click)
+      {
+         // revert to model predictor
+         defining_predictor = false;
+         const Predictor::Sequence& sequence = sequence_map.at (station);
+         const Dtime& dtime = time_chooser.get_time ();
+         this->predictor = sequence.at (dtime);
+         render_queue_draw ();
+         return true;
+      }
+      else
+      {
+         // start grabbing G circle
+         defining_predictor = true;
+         const Point_2D& w = transform.reverse (point);
+         predictor.wind_925 = Wind::direction_speed (w.x, w.y * 0.514444);
+         render_queue_draw ();
+         return true;
+      }
+
+   }
+
+   // set no predictor
+   //if (!no_wind_925 && !near_wind_925 && double_click)
+   if (false)
+   {
+      defining_predictor = false;
+      predictor.wind_925 = Wind (GSL_NAN, GSL_NAN);
+      render_queue_draw ();
+      return true;
+   }
+
+   if (double_click)
+   {
+      if (!near_wind_925)
+      {
+         wind_925_threshold = 5 * 0.514444;
+         render_queue_draw ();
+         return true;
+      }
+   } 
+
+   // cout cursor point
+   if (false)
+   {
+      const Wind_Disc::Transform& t = wind_disc.get_transform ();
+      const Wind& wind = t.get_wind (point);
+      cout << wind.get_string ("%03.0f/%02.1f") << endl;
+   }
+
+   if (triple_click)
+   {
+      clear_clusters ();
+      return true;
+   }
+
+   // define cluster; automatic clusters stop following the analog set
+   if (event.control () && !clusters.is_defining ())
+   {
+      grouping = "";
+      clusters.defining = clusters.size ();
+      clusters.push_back (new Cluster ());
+      clusters.add (point, clusters.defining);
+      render_queue_draw ();
+      return true;
+   }
+
+   return false;
+
+}
+
+bool
+Nine2five::on_mouse_motion (const Dmouse_Motion_Event& event)
+{
+
+   if (Dcontainer::on_mouse_motion (event)) { return true; }
+   const Point_2D& point = event.point;
+
+   if (defining_predictor)
+   {
+      const Transform_2D& transform = wind_disc.get_transform ();
+      const Point_2D& w = transform.reverse (point);
+      predictor.wind_925 = Wind::direction_speed (w.x, w.y * 0.514444);
+      queue_frame (true);
+      return true;
+   }
+
+   if (clusters.is_defining ())
+   {
+      clusters.add (point, clusters.defining);
+      queue_frame (false);
+      return true;
+   }
+
+   return false;
+
+}
+
+bool
+Nine2five::on_mouse_button_released (const Dmouse_Button_Event& event)
+{
+
+   if (Dcontainer::on_mouse_button_released (event)) { return true; }
+   const Point_2D& point = event.point;
+
+   if (defining_predictor)
+   {
+      // the real analog query replaces the interpolated probabilities
+      defining_predictor = false;
+      flush_frame ();
+      return true;
+   }
+
+   if (clusters.is_defining ())
+   {
+      Cluster& cluster = clusters.get_defining_cluster ();
+      if (cluster.size () > 2) { clusters.add (point, clusters.defining); }
+      else { clusters.remove (); }
+      clusters.defining = -1; 
+      flush_frame ();
+      return true;
+   }
+
+   return false;
+
+}
+
+bool
+Nine2five::on_mouse_scroll (const Dmouse_Scroll_Event& event)
+{
+
+   if (Dcontainer::on_mouse_scroll (event)) { return true; }
+   const Point_2D& point = event.point;
+
+   if (out_of_bounds (point)) { return false; }
+
+   if (event.control ())
+   {
+
+      switch (event.direction)
+      {
+
+         case GDK_SCROLL_UP:
+         {
+            wind_925_threshold *= 1.02;
+            queue_frame (false);
+            return true;
+            break;
+         }
+
+         case GDK_SCROLL_DOWN:
+         {
+            wind_925_threshold /= 1.02;
+            queue_frame (false);
+            return true;
+            break;
+         }
+
+      }
+
+   }
+
+   return false;
+
+}
+
+void
+Nine2five::update_predictor ()
+{
+   if (option_panel.auto_925_wind ())
+   {
+      const Predictor::Sequence& sequence = sequence_map.at (station);
+      const Dtime& dtime = time_chooser.get_time ();
+      this->predictor = sequence.at (dtime);
+   }
+   render_queue_draw ();
+}
+
+void
+Nine2five::render_image_buffer (const RefPtr<Context>& cr)
+{
+   const Dtime& dtime = time_chooser.get_time ();
+   render (cr, dtime, predictor);
+}
+
+void
+Nine2five::render_background_buffer (const RefPtr<Context>& cr)
+{
+
+//   const Color& color_0 = Color::hsb (0.6, 0.4, 0.8);
+//   const Color& color_1 = Color::hsb (0.6, 0.1, 0.4);
+   const Color& color_0 = Color::hsb (0.6, 0.0, 0.9);
+   const Color& color_1 = Color::hsb (0.6, 0.0, 0.7);
+   const Point_2D point_0 (0, 0);
+   const Point_2D point_1 (0, height);
+   Color_Gradient (color_0, color_1, point_0, point_1).cairo (cr);
+   cr->paint ();
+
+   Color::white (0.4).cairo (cr);
+   const Point_2D point (viewport.index_2d.i, viewport.index_2d.j);
+   Rect (point, viewport.size_2d.i, viewport.size_2d.j).cairo (cr);
+   cr->fill ();
+
+}
+
+void
+Nine2five::clear_clusters ()
+{
+   grouping = "";
+   clusters.clear ();
+   render_queue_draw ();
+}
+
+void
+Nine2five::make_calm_cluster (const Dstring& str)
+{
+
+   const Tokens tokens (str);
+   const Real speed = stof (tokens[1]);
+
+   grouping = "";
+   const Wind_Disc::Transform& t = wind_disc.get_transform ();
+   clusters.push_back (new Sector_Cluster (t, 0, 360, 0, speed));
+
+   render_queue_draw ();
+
+}
+
+void
+Nine2five::make_sector_cluster (const Dstring& str)
+{
+
+   const Dstring compass ("NESW");
+   const Real direction = compass.find (str[0]) * 90;
+
+   grouping = "";
+   const Wind_Disc::Transform& t = wind_disc.get_transform ();
+   clusters.push_back (new Sector_Cluster (t,
+      direction - 45, direction + 45, 0, GSL_POSINF));
+
+   render_queue_draw ();
+
+}
+
+void
+Nine2five::group (const Record::Columns& columns)
+{
+
+   Wind_Groups wind_groups;
+   clusters.clear ();
+
+   if (grouping == "K-means")
+   {
+      const Integer k = option_panel.get_number_of_groups ();
+      wind_groups.k_means (columns, k);
+   }
+   else
+   {
+      const Integer min_points = std::max (5, columns.size () / 200);
+      wind_groups.density (columns, 2, min_points);
+   }
+
+   wind_groups.feed (clusters, projection);
+
+}
+
+void
+Nine2five::make_auto_clusters (const Dstring& str)
+{
+   grouping = str;
+   grouped = false;
+   render_queue_draw ();
+}
+
+void
+Nine2five::regroup ()
+{
+   grouped = false;
+   render_queue_draw ();
+}
+
+void
+Nine2five::update_bootstrap (const Predictor& predictor)
+{
+
+   const Real t_925 = predictor.temperature_925;
+   const bool with_kde = clusters.with_kde;
+   const Dstring& key = columns_key + Dstring::render (":%f:%d:", t_925,
+      with_kde) + get_clusters_key ();
+
+   if (key == bootstrap_key || key == requested_bootstrap_key) { return; }
+   requested_bootstrap_key = key;
+
+   // the last intervals stay up until the new ones are done
+   typedef Bootstrap::Sample Sample;
+   const Record::Columns& columns = *columns_ptr;
+   const auto sample_ptr = make_shared<const Sample> (
+      clusters, columns, t_925, with_kde);
+
+   bootstrap_worker.post ([this, sample_ptr, key]
+      (const function<bool ()>& is_cancelled)
+   {
+
+      Bootstrap result;
+      if (!result.run (*sample_ptr, is_cancelled)) { return; }
+
+      {
+         std::lock_guard<std::mutex> lock (bootstrap_mutex);
+         pending_bootstrap = result;
+         pending_bootstrap_key = key;
+      }
+
+      bootstrap_dispatcher.emit ();
+
+   });
+
+}
+
+void
+Nine2five::on_bootstrap_ready ()
+{
+
+   {
+      std::lock_guard<std::mutex> lock (bootstrap_mutex);
+      if (pending_bootstrap_key.empty ()) { return; }
+      // unless newer intervals have been asked for since
+      if (pending_bootstrap_key == requested_bootstrap_key)
+      {
+         bootstrap = pending_bootstrap;
+         bootstrap_key = pending_bootstrap_key;
+      }
+      pending_bootstrap_key = "";
+   }
+
+   render_queue_draw ();
+
+}
+
+void
+Nine2five::update_sensitivity (const Dtime& dtime,
+                               const Predictor& predictor)
+{
+
+   // only the plain analog query with Gaussian fits is swept
+   const Option_Panel& op = option_panel;
+   if (op.with_weighted_analogs () || op.get_trajectory_hours () > 0 ||
+       op.with_kde ())
+   {
+      sensitivity_worker.cancel ();
+      requested_sensitivity_key = "";
+      sensitivity_key = "";
+      wind_925_sensitivity.clear ();
+      day_of_year_sensitivity.clear ();
+      return;
+   }
+
+   const Real t_925 = predictor.temperature_925;
+   const Dstring& key = columns_key + Dstring::render (":%f:", t_925) +
+      get_clusters_key ();
+
+   if (key == sensitivity_key || key == requested_sensitivity_key) { return; }
+   requested_sensitivity_key = key;
+
+   const Integer day_of_year = stoi (dtime.get_string ("%j"));
+   const Integer hour = stoi (dtime.get_string ("%H"));
+   const Integer day_of_year_threshold = op.get_day_of_year_threshold ();
+   const Integer hour_threshold = op.get_hour_threshold ();
+   const Real wind_925_threshold = this->wind_925_threshold;
+   const Station_Data& station_data = data.get_station_data (station);
+   const Wind_Disc::Transform transform = wind_disc.get_transform ();
+   const Wind w = predictor.wind_925;
+
+   // the outlines may be edited here while the worker classifies
+   const shared_ptr<Clusters> clusters_ptr (clusters.clone ());
+
+   sensitivity_worker.post ([this, &station_data, clusters_ptr, transform,
+      day_of_year, hour, day_of_year_threshold, hour_threshold,
+      wind_925_threshold, w, t_925, key]
+      (const function<bool ()>& is_cancelled)
+   {
+
+      typedef Sensitivity::Candidates Candidates;
+      const Real multiplier = 0.51444444;
+      clusters_ptr->refresh_mask ();
+
+      // candidates at any 925 hPa wind, by wind difference in knots
+      Sensitivity by_wind_925;
+      if (!w.is_naw ())
+      {
+
+         const Record::Set* record_set_ptr = station_data.get_record_set_ptr (
+            day_of_year, day_of_year_threshold, hour, hour_threshold,
+            w, GSL_NAN, Extra_Schema::Query (), is_cancelled);
+         const Record::Columns candidates (*record_set_ptr);
+         delete record_set_ptr;
+         if (is_cancelled ()) { return; }
+
+         Tuple distance_tuple;
+         for (Integer k = 0; k < candidates.size (); k++)
+         {
+            const Real d = candidates.direction_925_tuple[k];
+            const Real s = candidates.speed_925_tuple[k] * multiplier;
+            const Wind& difference = Wind::direction_speed (d, s) - w;
+            const Real distance = difference.get_speed () / multiplier;
+            distance_tuple.push_back (gsl_isnan (distance) ? GSL_POSINF : distance);
+         }
+
+         const Candidates c (*clusters_ptr, candidates, transform, distance_tuple);
+         Tuple threshold_tuple;
+         for (Real x = 0.5; x <= 30; x += 0.5) { threshold_tuple.push_back (x); }
+         if (!by_wind_925.sweep (c, threshold_tuple, false, t_925, is_cancelled))
+         {
+            return;
+         }
+
+      }
+
+      // candidates on any day of the year, by calendar distance
+      Sensitivity by_day_of_year;
+      {
+
+         const Record::Set* record_set_ptr = station_data.get_record_set_ptr (
+            day_of_year, 183, hour, hour_threshold, w, wind_925_threshold,
+            Extra_Schema::Query (), is_cancelled);
+         const Record::Columns candidates (*record_set_ptr);
+         delete record_set_ptr;
+         if (is_cancelled ()) { return; }
+
+         Tuple distance_tuple;
+         for (Integer k = 0; k < candidates.size (); k++)
+         {
+            const Dtime& dtime = candidates.dtime_tuple[k];
+            const Integer j = stoi (dtime.get_string ("%j"));
+            const Integer a = abs (j - day_of_year);
+            const Integer b = (day_of_year + 365) - j;
+            const Integer c = (j + 365) - day_of_year;
+            distance_tuple.push_back (std::min (a, std::min (b, c)));
+         }
+
+         const Candidates c (*clusters_ptr, candidates, transform, distance_tuple);
+         Tuple threshold_tuple;
+         for (Integer x = 0; x <= 90; x++) { threshold_tuple.push_back (x); }
+         if (!by_day_of_year.sweep (c, threshold_tuple,
+            true, t_925, is_cancelled)) { return; }
+
+      }
+
+      {
+         std::lock_guard<std::mutex> lock (sensitivity_mutex);
+         pending_wind_925_sensitivity = by_wind_925;
+         pending_day_of_year_sensitivity = by_day_of_year;
+         pending_sensitivity_key = key;
+      }
+
+      sensitivity_dispatcher.emit ();
+
+   });
+
+}
+
+void
+Nine2five::on_sensitivity_ready ()
+{
+
+   {
+      std::lock_guard<std::mutex> lock (sensitivity_mutex);
+      if (pending_sensitivity_key.empty ()) { return; }
+      // unless a newer sweep has been asked for since
+      if (pending_sensitivity_key == requested_sensitivity_key)
+      {
+         wind_925_sensitivity = pending_wind_925_sensitivity;
+         day_of_year_sensitivity = pending_day_of_year_sensitivity;
+         sensitivity_key = pending_sensitivity_key;
+      }
+      pending_sensitivity_key = "";
+   }
+
+   render_queue_draw ();
+
+}
+
+void
+Nine2five::render_sensitivity (const RefPtr<Context>& cr) const
+{
+
+   const Size_2D size_2d (180, 80);
+   const Point_2D& sw = viewport.get_nw () + Point_2D (10, viewport.size_2d.j);
+   const Index_2D index_925 (sw.x, sw.y - 2 * (size_2d.j + 10));
+   const Index_2D index_day_of_year (sw.x, sw.y - (size_2d.j + 10));
+
+   const Real threshold = wind_925_threshold / 0.51444444;
+   const Real day_of_year_threshold = option_panel.get_day_of_year_threshold ();
+
+   wind_925_sensitivity.render (cr, Box_2D (index_925, size_2d),
+      threshold, "925hPa wind threshold (kt)");
+   day_of_year_sensitivity.render (cr, Box_2D (index_day_of_year, size_2d),
+      day_of_year_threshold, "Day-of-year threshold (days)");
+
+}
+
+const Archive&
+Nine2five::get_archive ()
+{
+   if (archive_ptr == nullptr || archive_station != station)
+   {
+      trajectory_index_ptr = nullptr;
+      archive_ptr = make_shared<Archive> (data.get_station_data (station));
+      archive_station = station;
+   }
+   return *archive_ptr;
+}
+
+const Trajectory_Index&
+Nine2five::get_trajectory_index (const Integer hours)
+{
+
+   const Archive& archive = get_archive ();
+
+   // 925 hPa winds at the archive spacing back from the record itself
+   const Real step = (archive.time_step > 0 ? archive.time_step : 3);
+   Tuple lag_tuple;
+   for (Real lag = 0; lag <= hours + 1e-6; lag += step) { lag_tuple.push_back (lag); }
+
+   if (trajectory_index_ptr == nullptr ||
+       trajectory_index_ptr->get_lag_tuple () != lag_tuple)
+   {
+      trajectory_index_ptr = make_shared<Trajectory_Index> (archive, lag_tuple);
+   }
+
+   return *trajectory_index_ptr;
+
+}
+
+bool
+Nine2five::get_trajectory (Tuple& u_tuple,
+                           Tuple& v_tuple,
+                           const Dtime& dtime,
+                           const Predictor& predictor,
+                           const Tuple& lag_tuple) const
+{
+
+   const Predictor::Sequence& sequence = sequence_map.at (station);
+   const Real multiplier = 0.51444444;
+
+   for (const Real lag : lag_tuple)
+   {
+
+      // the predictor itself stands at lag 0, as it may have been dragged
+      auto iterator = sequence.find (Dtime (dtime.t - lag));
+      if (lag > 0 && iterator == sequence.end ()) { return false; }
+      const Wind& wind_925 = (lag > 0 ?
+         iterator->second.wind_925 : predictor.wind_925);
+      if (wind_925.is_naw ()) { return false; }
+
+      const Real theta = wind_925.get_direction () * M_PI / 180;
+      const Real speed = wind_925.get_speed () / multiplier;
+      u_tuple.push_back (-speed * sin (theta));
+      v_tuple.push_back (-speed * cos (theta));
+
+   }
+
+   return true;
+
+}
+
+Dstring
+Nine2five::get_surface_key (const Dtime& dtime,
+                            const Predictor& predictor) const
+{
 
-   return false;
+   // the surface covers every predictor wind, so that is not in the
+   // key; the modes are, so that a plain surface never stands in for
+   // the weighted, trajectory or KDE model
+   const Option_Panel& op = option_panel;
+   return Dstring::render ("%s:%s:%d:%d:%f:%f:%d:%d:%d:", station.c_str (),
+      dtime.get_string ("%j:%H").c_str (), op.get_day_of_year_threshold (),
+      op.get_hour_threshold (), wind_925_threshold,
+      predictor.temperature_925, op.with_weighted_analogs (),
+      op.get_trajectory_hours (), op.with_kde ()) + get_clusters_key ();
 
 }
 
-bool
-Nine2five::on_mouse_button_pressed (const Dmouse_Button_Event& event)
+void
+Nine2five::update_surface (const Dtime& dtime,
+                           const Predictor& predictor)
 {
 
-   if (Dcontainer::on_mouse_button_pressed (event)) { return true; }
-   const Point_2D& point = event.point;
+   // only the plain analog query with Gaussian fits is tabulated
+   const Option_Panel& op = option_panel;
+   if (op.with_weighted_analogs () || op.get_trajectory_hours () > 0 ||
+       op.with_kde ())
+   {
+      return;
+   }
 
-   const Wind_Disc::Transform& transform = wind_disc.get_transform ();
-   const Wind& w = transform.get_wind (point);
-   const bool no_wind_925 = predictor.wind_925.is_naw ();
-   const Real difference = (w - predictor.wind_925).get_speed ();
-   const bool near_wind_925 = (difference <= wind_925_threshold);
-   const bool double_click = (event.type == GDK_2BUTTON_PRESS);
-   const bool triple_click = (event.type == GDK_3BUTTON_PRESS);
+   const Dstring& key = get_surface_key (dtime, predictor);
+   if (key == surface_key || key == requested_surface_key) { return; }
+   requested_surface_key = key;
 
-   //if (near_wind_925 || (no_wind_925 && double_click))
-   if (near_wind_925)
+   const Integer day_of_year = stoi (dtime.get_string ("%j"));
+   const Integer hour = stoi (dtime.get_string ("%H"));
+   const Integer day_of_year_threshold = op.get_day_of_year_threshold ();
+   const Integer hour_threshold = op.get_hour_threshold ();
+   const Station_Data& station_data = data.get_station_data (station);
+   const Wind_Disc::Transform transform = wind_disc.get_transform ();
+   const Real threshold = wind_925_threshold / 0.51444444;
+   const Real t_925 = predictor.temperature_925;
+
+   // the outlines may be edited here while the worker classifies
+   const shared_ptr<Clusters> clusters_ptr (clusters.clone ());
+
+   surface_worker.post ([this, &station_data, clusters_ptr, transform,
+      day_of_year, hour, day_of_year_threshold, hour_threshold,
+      threshold, t_925, key] (const function<bool ()>& is_cancelled)
    {
 
-      if (double_click)
+      const Record::Set* record_set_ptr = station_data.get_record_set_ptr (
+         day_of_year, day_of_year_threshold, hour, hour_threshold,
+         Wind (GSL_NAN, GSL_NAN), GSL_NAN, Extra_Schema::Query (),
+         is_cancelled);
+      const Record::Columns columns (*record_set_ptr);
+      delete record_set_ptr;
+      if (is_cancelled ()) { return; }
+
+      clusters_ptr->refresh_mask ();
+      const Response_Surface::Candidates candidates (
+         *clusters_ptr, columns, transform);
+      Response_Surface* response_surface_ptr = new Response_Surface ();
+
+      if (!response_surface_ptr->compute (candidates,
+         threshold, t_925, is_cancelled))
       {
-         // revert to model predictor
-         defining_predictor = false;
-         const Predictor::Sequence& sequence = sequence_map.at (station);
-         const Dtime& dtime = time_chooser.get_time ();
-         this->predictor = sequence.at (dtime);
-         render_queue_draw ();
-         return true;
+         delete response_surface_ptr;
+         return;
       }
-      else
+
       {
-         // start grabbing G circle
-         defining_predictor = true;
-         const Point_2D& w = transform.reverse (point);
-         predictor.wind_925 = Wind::direction_speed (w.x, w.y * 0.514444);
-         render_queue_draw ();
-         return true;
+         std::lock_guard<std::mutex> lock (surface_mutex);
+         delete pending_surface_ptr;
+         pending_surface_ptr = response_surface_ptr;
+         pending_surface_key = key;
       }
 
-   }
+      surface_dispatcher.emit ();
 
-   // set no predictor
-   //if (!no_wind_925 && !near_wind_925 && double_click)
-   if (false)
-   {
-      defining_predictor = false;
-      predictor.wind_925 = Wind (GSL_NAN, GSL_NAN);
-      render_queue_draw ();
-      return true;
-   }
+   });
+
+}
+
+void
+Nine2five::on_surface_ready ()
+{
 
-   if (double_click)
    {
-      if (!near_wind_925)
+      std::lock_guard<std::mutex> lock (surface_mutex);
+      if (pending_surface_ptr == nullptr) { return; }
+      // unless a newer surface has been asked for since
+      if (pending_surface_key == requested_surface_key)
       {
-         wind_925_threshold = 5 * 0.514444;
-         render_queue_draw ();
-         return true;
+         delete surface_ptr;
+         surface_ptr = pending_surface_ptr;
+         surface_key = pending_surface_key;
       }
-   } 
-
-   // cout cursor point
-   if (false)
-   {
-      const Wind_Disc::Transform& t = wind_disc.get_transform ();
-      const Wind& wind = t.get_wind (point);
-      cout << wind.get_string ("%03.0f/%02.1f") << endl;
+      else { delete pending_surface_ptr; }
+      pending_surface_ptr = nullptr;
    }
 
-   if (triple_click)
+   render_queue_draw ();
+
+}
+
+Dstring
+Nine2five::get_disc_key () const
+{
+   const Wind_Disc::Transform& t = wind_disc.get_transform ();
+   const Point_2D& a = t.transform (Point_2D (0, 10));
+   const Point_2D& b = t.transform (Point_2D (90, 20));
+   return Dstring::render ("%fx%f:%f:%f:%f:%f", Real (width),
+      Real (height), a.x, a.y, b.x, b.y);
+}
+
+Dstring
+Nine2five::get_clusters_key () const
+{
+   Dstring key;
+   for (const Cluster* cluster_ptr : clusters)
    {
-      clear_clusters ();
-      return true;
+      key += Dstring::render ("%d:%d:", cluster_ptr->id, cluster_ptr->version);
    }
+   return key;
+}
 
-   // define cluster
-   if (event.control () && !clusters.is_defining ())
+void
+Nine2five::queue_frame (const bool superseding)
+{
+
+   // a superseding event replaces state nobody saw, as a new G position
+   // does; others add to it, as outline points and scroll steps do
+   event_count++;
+   if (frame_tick_id != 0)
    {
-      clusters.defining = clusters.size ();
-      clusters.push_back (new Cluster ());
-      clusters.get_defining_cluster ().add (point);
-      render_queue_draw ();
-      return true;
+      if (superseding) { dropped_count++; } else { merged_count++; }
+      return;
    }
 
-   return false;
+   // redraw on the next tick of the widget's frame clock, so the pace
+   // follows the display rather than a guessed refresh rate
+   frame_tick_id = add_tick_callback (sigc::mem_fun (
+      *this, &Nine2five::on_frame_tick));
 
 }
 
 bool
-Nine2five::on_mouse_motion (const Dmouse_Motion_Event& event)
+Nine2five::on_frame_tick (const Glib::RefPtr<Gdk::FrameClock>& frame_clock)
 {
+   frame_tick_id = 0;
+   on_frame ();
+   return false;
+}
 
-   if (Dcontainer::on_mouse_motion (event)) { return true; }
-   const Point_2D& point = event.point;
+void
+Nine2five::on_frame ()
+{
+   frame_count++;
+   render_queue_draw ();
+}
 
-   if (defining_predictor)
+void
+Nine2five::flush_frame ()
+{
+   if (frame_tick_id != 0)
    {
-      const Transform_2D& transform = wind_disc.get_transform ();
-      const Point_2D& w = transform.reverse (point);
-      predictor.wind_925 = Wind::direction_speed (w.x, w.y * 0.514444);
-      render_queue_draw ();
-      return true;
+      remove_tick_callback (frame_tick_id);
+      frame_tick_id = 0;
    }
+   on_frame ();
+}
 
-   if (clusters.is_defining ())
-   {
-      clusters.get_cluster (clusters.defining).add (point);
-      render_queue_draw ();
-      return true;
-   }
+void
+Nine2five::render_frame_stats (const RefPtr<Context>& cr) const
+{
 
-   return false;
+   const Dstring& str = Dstring::render ("%d events  %d frames  "
+      "%d merged  %d dropped  layers %d/%d/%d  %d discarded  %d stalls",
+      event_count, frame_count, merged_count, dropped_count,
+      disc_layer.render_count, scatter_layer.render_count,
+      statistics_layer.render_count, scatter_layer.discarded_count,
+      stall_count);
+
+   const Point_2D anchor (width - 10, height - 10);
+   cr->save ();
+   cr->set_font_size (12);
+   Label (str, anchor, 'r', 'b').cairo (cr, Color::gray (0.2, 0.7),
+      Color::gray (0.8, 0.9), Point_2D (-3, 3));
+   cr->restore ();
 
 }
 
-bool
-Nine2five::on_mouse_button_released (const Dmouse_Button_Event& event)
+void
+Nine2five::render_pipeline (const RefPtr<Context>& cr) const
 {
 
-   if (Dcontainer::on_mouse_button_released (event)) { return true; }
-   const Point_2D& point = event.point;
+   // stages worked out in this frame are marked red, with the number
+   // of times each has been worked out so far
+   cr->save ();
+   cr->set_font_size (12);
 
-   if (defining_predictor)
+   const Integer n = stage_ptr_tuple.size ();
+   for (Integer i = 0; i < n; i++)
    {
-      defining_predictor = false;
-      return true;
+      const Stage& stage = *(stage_ptr_tuple[i]);
+      const Dstring& str = Dstring::render ("%s %d",
+         stage.name.c_str (), stage.recompute_count);
+      const Point_2D anchor (10, height - 10 - (n - 1 - i) * 15);
+      const Color& bg_color = (stage.recomputed ?
+         Color::red (0.6) : Color::gray (0.8, 0.9));
+      Label (str, anchor, 'l', 'b').cairo (cr, Color::gray (0.2, 0.7),
+         bg_color, Point_2D (-3, 3));
    }
 
-   if (clusters.is_defining ())
+   cr->restore ();
+
+}
+
+const Predictor&
+Nine2five::get_play_predictor (const Dtime& dtime) const
+{
+   const bool auto_925_wind = option_panel.auto_925_wind ();
+   return (auto_925_wind ? sequence_map.at (station).at (dtime) : predictor);
+}
+
+void
+Nine2five::update_playback ()
+{
+
+   play_connection.disconnect ();
+   playback.clear ();
+
+   if (!option_panel.is_playing ())
    {
-      Cluster& cluster = clusters.get_defining_cluster ();
-      if (cluster.size () > 2) { cluster.add (point); }
-      else { clusters.remove (); }
-      clusters.defining = -1; 
+      export_path = "";
       render_queue_draw ();
-      return true;
+      return;
    }
 
-   return false;
+   const Real play_interval = 1000.0 / 4;
+   play_connection = Glib::signal_timeout ().connect (sigc::mem_fun (
+      *this, &Nine2five::on_play_tick), Integer (play_interval));
 
 }
 
-bool
-Nine2five::on_mouse_scroll (const Dmouse_Scroll_Event& event)
+void
+Nine2five::stop_playback ()
 {
+   if (option_panel.is_playing ()) { option_panel.toggle_play (); }
+   else { update_playback (); }
+}
 
-   if (Dcontainer::on_mouse_scroll (event)) { return true; }
-   const Point_2D& point = event.point;
+void
+Nine2five::fill_playback ()
+{
 
-   if (out_of_bounds (point)) { return false; }
+   Dtime dtime;
+   const bool exporting = !export_path.empty ();
+   const Predictor::Sequence& sequence = sequence_map.at (station);
 
-   if (event.control ())
+   // nothing else may read the archive while it could be rebuilt
+   if (!playback.get_back (dtime)) { cancel_queries (); }
+
+   while (!playback.is_full ())
    {
 
-      switch (event.direction)
+      // an export starts at the beginning and plays the sequence once;
+      // otherwise the frames after the playhead loop
+      Predictor::Sequence::const_iterator iterator;
+      if (playback.get_back (dtime)) { iterator = sequence.upper_bound (dtime); }
+      else
+      if (exporting && export_count == 0) { iterator = sequence.begin (); }
+      else { iterator = sequence.upper_bound (time_chooser.get_time ()); }
+
+      if (iterator == sequence.end ())
       {
+         if (exporting) { return; }
+         iterator = sequence.begin ();
+      }
 
-         case GDK_SCROLL_UP:
-         {
-            wind_925_threshold *= 1.02;
-            render_queue_draw ();
-            return true;
-            break;
-         }
+      const Dtime& t = iterator->first;
+      const Predictor& p = get_play_predictor (t);
+      const Query& query = get_query (t, p);
+      const Station_Data& station_data = data.get_station_data (station);
+      playback.push (t, get_columns_key (station, t, p), [query, &station_data]
+         (const function<bool ()>& is_cancelled)
+      {
+         return query (station_data, is_cancelled);
+      });
 
-         case GDK_SCROLL_DOWN:
-         {
-            wind_925_threshold /= 1.02;
-            render_queue_draw ();
-            return true;
-            break;
-         }
+   }
 
-      }
+}
 
+bool
+Nine2five::on_play_tick ()
+{
+
+   // frames queued before a change of station or option are dropped
+   Dtime dtime;
+   Dstring key;
+   if (playback.get_front (dtime, key) &&
+       key != get_columns_key (station, dtime, get_play_predictor (dtime)))
+   {
+      cancel_queries ();
+      playback.clear ();
    }
 
-   return false;
+   fill_playback ();
 
-}
+   // only an export runs out of frames
+   if (!playback.get_front (dtime, key))
+   {
+      stop_playback ();
+      return false;
+   }
 
-void
-Nine2five::update_predictor ()
-{
-   if (option_panel.auto_925_wind ())
+   // the playhead holds while its frame is worked out
+   Record::Columns* columns_ptr = playback.pop ();
+   if (columns_ptr == nullptr)
    {
-      const Predictor::Sequence& sequence = sequence_map.at (station);
-      const Dtime& dtime = time_chooser.get_time ();
-      this->predictor = sequence.at (dtime);
+      stall_count++;
+      return true;
    }
-   render_queue_draw ();
-}
 
-void
-Nine2five::render_image_buffer (const RefPtr<Context>& cr)
-{
-   const Dtime& dtime = time_chooser.get_time ();
-   render (cr, dtime, predictor);
+   // the frame's set is taken as a finished query would be
+   query_key = key;
+   cancel_queries ();
+   set_columns (columns_ptr, key);
+   time_chooser.set_time (dtime);
+   update_predictor ();
+
+   if (!export_path.empty ())
+   {
+      const Dstring& file_name = station + dtime.get_string ("_%Y%m%d%H.png");
+      save (export_path + "/" + file_name);
+      export_count++;
+   }
+
+   return true;
+
 }
 
 void
-Nine2five::render_background_buffer (const RefPtr<Context>& cr)
+Nine2five::export_series ()
 {
 
-//   const Color& color_0 = Color::hsb (0.6, 0.4, 0.8);
-//   const Color& color_1 = Color::hsb (0.6, 0.1, 0.4);
-   const Color& color_0 = Color::hsb (0.6, 0.0, 0.9);
-   const Color& color_1 = Color::hsb (0.6, 0.0, 0.7);
-   const Point_2D point_0 (0, 0);
-   const Point_2D point_1 (0, height);
-   Color_Gradient (color_0, color_1, point_0, point_1).cairo (cr);
-   cr->paint ();
+   using namespace Gtk;
 
-   Color::white (0.4).cairo (cr);
-   const Point_2D point (viewport.index_2d.i, viewport.index_2d.j);
-   Rect (point, viewport.size_2d.i, viewport.size_2d.j).cairo (cr);
-   cr->fill ();
+   FileChooserDialog dialog ("Export Image Series...",
+      FILE_CHOOSER_ACTION_SELECT_FOLDER);
+   dialog.set_transient_for (*window_ptr);
+   dialog.add_button (Stock::CANCEL, RESPONSE_CANCEL);
+   dialog.add_button (Stock::SAVE, RESPONSE_OK);
+   if (dialog.run () != RESPONSE_OK) { return; }
 
-}
+   // the sequence is played once from the start, one PNG per frame
+   export_path = dialog.get_filename ();
+   export_count = 0;
+   if (option_panel.is_playing ()) { update_playback (); }
+   else { option_panel.toggle_play (); }
 
-void
-Nine2five::clear_clusters ()
-{
-   clusters.clear ();
-   render_queue_draw ();
 }
 
 void
-Nine2five::make_calm_cluster (const Dstring& str)
+Nine2five::render_status (const RefPtr<Context>& cr) const
 {
 
-   const Tokens tokens (str);
-   const Real speed = stof (tokens[1]);
-
-   clusters.defining = clusters.size ();
-   clusters.push_back (new Cluster ());
-   Cluster& cluster = clusters.get_defining_cluster ();
+   if (with_frame_stats) { render_frame_stats (cr); }
+   if (with_pipeline_view) { render_pipeline (cr); }
 
-   const Wind_Disc::Transform& t = wind_disc.get_transform ();
-   for (Integer i = 0; i < 360; i++)
+   if (exporter.pending_count > 0 || !export_message.empty ())
    {
-      const Point_2D& p = t.transform (Point_2D (i, speed));
-      cluster.add (p);
+      const Point_2D anchor (viewport.get_nw () + Index_2D (10, 70));
+      const Dstring& str = (exporter.pending_count > 0 ? Dstring::render (
+         "saving %d file(s)\u2026", exporter.pending_count) : export_message);
+      cr->save ();
+      cr->set_font_size (12);
+      Label (str, anchor, 'l', 't').cairo (cr,
+         Color::gray (0.2, 0.7), Color::gray (0.8, 0.9), Point_2D (-3, 3));
+      cr->restore ();
    }
 
-   clusters.defining = -1;
+   if (!export_path.empty ())
+   {
+      const Point_2D anchor (viewport.get_nw () + Index_2D (10, 55));
+      const Dstring& str = Dstring::render ("exporting %d of %d",
+         export_count, Integer (sequence_map.at (station).size ()));
+      cr->save ();
+      cr->set_font_size (12);
+      Label (str, anchor, 'l', 't').cairo (cr,
+         Color::gray (0.2, 0.7), Color::gray (0.8, 0.9), Point_2D (-3, 3));
+      cr->restore ();
+   }
 
-   render_queue_draw ();
+   if (query_key != columns_key)
+   {
+      const Point_2D anchor (viewport.get_nw () + Index_2D (10, 40));
+      cr->save ();
+      cr->set_font_size (12);
+      Label ("computing\u2026", anchor, 'l', 't').cairo (cr,
+         Color::gray (0.2, 0.7), Color::gray (0.8, 0.9), Point_2D (-3, 3));
+      cr->restore ();
+   }
 
 }
-
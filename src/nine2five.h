@@ -1,7 +1,14 @@
 #ifndef NINE2FIVE_NINE2FIVE_H
 #define NINE2FIVE_NINE2FIVE_H
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <denise/gtkmm.h>
 #include <denise/met.h>
 //#include "selection.h"
@@ -50,6 +57,12 @@ namespace nine2five
          Spin_Button
          hour_threshold_button;
 
+         Dtoggle_Button
+         weighted_button;
+
+         Spin_Button
+         trajectory_button;
+
          Dtoggle_Button
          noise_button;
 
@@ -62,6 +75,18 @@ namespace nine2five
          Dtoggle_Button
          percentages_button;
 
+         Dtoggle_Button
+         bootstrap_button;
+
+         Dtoggle_Button
+         kde_button;
+
+         Dtoggle_Button
+         sensitivity_button;
+
+         Dtoggle_Button
+         surface_button;
+
          Dbutton
          clear_clusters_button;
 
@@ -74,12 +99,45 @@ namespace nine2five
          Dbutton
          calm_7_cluster_button;
 
+         Dbutton
+         n_sector_button;
+
+         Dbutton
+         e_sector_button;
+
+         Dbutton
+         s_sector_button;
+
+         Dbutton
+         w_sector_button;
+
+         Spin_Button
+         group_button;
+
+         Spin_Button
+         dots_button;
+
+         Dbutton
+         k_means_button;
+
+         Dbutton
+         density_button;
+
          Dtoggle_Button
          auto_925_wind_button;
 
          Dbutton
          save_button;
 
+         Spin_Button
+         scale_button;
+
+         Dtoggle_Button
+         play_button;
+
+         Dbutton
+         export_button;
+
       public:
 
          Option_Panel (Nine2five& nine2five);
@@ -96,6 +154,9 @@ namespace nine2five
          void
          toggle_percentages ();
 
+         void
+         toggle_play ();
+
          bool
          with_noise () const;
 
@@ -108,15 +169,527 @@ namespace nine2five
          bool
          with_percentages () const;
 
+         bool
+         with_bootstrap () const;
+
+         bool
+         with_kde () const;
+
+         bool
+         with_sensitivity () const;
+
+         bool
+         with_surface () const;
+
+         Integer
+         get_max_dots () const;
+
          Integer
          get_day_of_year_threshold () const;
 
          Integer
          get_hour_threshold () const;
 
+         bool
+         with_weighted_analogs () const;
+
+         Integer
+         get_trajectory_hours () const;
+
+         Integer
+         get_number_of_groups () const;
+
          bool
          auto_925_wind () const;
 
+         bool
+         is_playing () const;
+
+         Real
+         get_export_scale () const;
+
+   };
+
+   // A cached transparent image of part of the frame, drawn again only
+   // when its key changes; vector targets are always drawn directly
+   class Layer
+   {
+
+      private:
+
+         RefPtr<ImageSurface>
+         surface;
+
+         Dstring
+         key;
+
+      public:
+
+         Integer
+         render_count;
+
+         Layer ();
+
+         void
+         clear ();
+
+         void
+         render (const RefPtr<Context>& cr,
+                 const Size_2D& size_2d,
+                 const Dstring& key,
+                 const function<void (const RefPtr<Context>&)>& draw);
+
+   };
+
+   // One step of the frame: the data snapshot, the analog query, the
+   // projected points, the cluster assignment, the statistics and the
+   // layers.  A step is worked out again only when its key, made of its
+   // own inputs and the versions of the steps it reads, changes.
+   class Stage
+   {
+
+      private:
+
+         Dstring
+         key;
+
+      public:
+
+         const Dstring
+         name;
+
+         // bumped on each change of key, for the steps downstream
+         Integer
+         version;
+
+         Integer
+         recompute_count;
+
+         // whether the step was worked out in the current frame
+         bool
+         recomputed;
+
+         Stage (const Dstring& name);
+
+         bool
+         update (const Dstring& key);
+
+         void
+         invalidate ();
+
+   };
+
+   // Analog sets for the frames ahead of the playhead, worked out by a
+   // pool of workers into a ring of fixed size.  Frames are taken from
+   // the front in the order they were pushed.
+   class Playback
+   {
+
+      public:
+
+         typedef function<Record::Columns* (const function<bool ()>&)>
+         Job;
+
+      private:
+
+         class Slot
+         {
+
+            public:
+
+               Dtime
+               dtime;
+
+               Dstring
+               key;
+
+               Job
+               job;
+
+               Record::Columns*
+               columns_ptr;
+
+               bool
+               started;
+
+               bool
+               done;
+
+         };
+
+         vector<Slot>
+         ring;
+
+         Integer
+         front;
+
+         Integer
+         size;
+
+         // jobs of an older generation are thrown away when done
+         std::atomic<Integer>
+         generation;
+
+         Integer
+         busy_count;
+
+         bool
+         stopping;
+
+         mutable std::mutex
+         mutex;
+
+         std::condition_variable
+         condition;
+
+         std::condition_variable
+         idle_condition;
+
+         // started on the first push
+         const Integer
+         number_of_threads;
+
+         vector<std::thread>
+         thread_tuple;
+
+         Integer
+         get_next () const;
+
+         void
+         run ();
+
+      public:
+
+         Playback (const Integer capacity,
+                   const Integer number_of_threads);
+
+         ~Playback ();
+
+         bool
+         is_full () const;
+
+         bool
+         get_front (Dtime& dtime,
+                    Dstring& key) const;
+
+         bool
+         get_back (Dtime& dtime) const;
+
+         void
+         push (const Dtime& dtime,
+               const Dstring& key,
+               const Job& job);
+
+         // the set of the front frame, passed to the caller, or nullptr
+         // while it is still being worked out
+         Record::Columns*
+         pop ();
+
+         // drops every frame and waits for the jobs in flight
+         void
+         clear ();
+
+   };
+
+   // The analog scatter, with each ring and "G" marker stamped from an
+   // alpha mask rendered once, and the edges of each colour stroked as
+   // one path.  Past max_dots records each cluster is shaded by its
+   // density on a grid of fixed cell count instead.
+   class Scatter_Plot
+   {
+
+      private:
+
+         const Real
+         ring_size;
+
+         const Real
+         mask_size;
+
+         RefPtr<ImageSurface>
+         ring_mask;
+
+         RefPtr<ImageSurface>
+         g_mask;
+
+         RefPtr<ImageSurface>
+         get_mask (const function<void (const RefPtr<Context>&,
+                                        const Point_2D&)>& draw) const;
+
+         void
+         render_density (const RefPtr<Context>& cr,
+                         const vector<Point_2D>& point_tuple,
+                         const Tuple& weight_tuple,
+                         const map<Integer, vector<Integer> >& k_tuple_map) const;
+
+      public:
+
+         // copies of what the plot shows, so it can be drawn on another
+         // thread while the analog set and clusters move on
+         class Snapshot
+         {
+
+            public:
+
+               vector<Point_2D>
+               point_tuple;
+
+               vector<Point_2D>
+               point_925_tuple;
+
+               Tuple
+               weight_tuple;
+
+               vector<Integer>
+               index_tuple;
+
+               Integer
+               max_dots;
+
+               Snapshot (const Record::Columns& columns,
+                         const Record::Projection& projection,
+                         const vector<Integer>& index_tuple,
+                         const bool with_noise,
+                         const Integer max_dots = -1);
+
+         };
+
+         Scatter_Plot (const Real ring_size = 8);
+
+         void
+         render (const RefPtr<Context>& cr,
+                 const Snapshot& snapshot) const;
+
+         // time to snapshot and draw the scatter layer alone, cleared
+         // and flushed each frame, on an offscreen image; the query,
+         // cluster analysis, other layers and the blit are not included
+         static void
+         benchmark (const Wind_Disc::Transform& transform,
+                    const Size_2D& size_2d);
+
+   };
+
+   // A Layer drawn by a worker thread.  The main thread paints the
+   // latest finished surface; a request not yet started is replaced by
+   // a newer one, and a result older than the one shown is dropped.
+   // Only the scatter is drawn this way; the rest of the frame, and the
+   // analysis it needs, still runs on the main thread.
+   class Async_Layer
+   {
+
+      public:
+
+         typedef function<void (const RefPtr<Context>&)>
+         Draw;
+
+      private:
+
+         const function<void ()>
+         on_ready;
+
+         RefPtr<ImageSurface>
+         surface;
+
+         Integer
+         generation;
+
+         Integer
+         shown_generation;
+
+         Dstring
+         requested_key;
+
+         std::mutex
+         mutex;
+
+         std::condition_variable
+         condition;
+
+         bool
+         stopping;
+
+         bool
+         pending;
+
+         Draw
+         pending_draw;
+
+         Size_2D
+         pending_size_2d;
+
+         Integer
+         pending_generation;
+
+         RefPtr<ImageSurface>
+         done_surface;
+
+         Integer
+         done_generation;
+
+         Glib::Dispatcher
+         dispatcher;
+
+         std::thread
+         thread;
+
+         void
+         run ();
+
+         void
+         on_done ();
+
+      public:
+
+         Integer
+         render_count;
+
+         Integer
+         discarded_count;
+
+         Async_Layer (const function<void ()>& on_ready);
+
+         ~Async_Layer ();
+
+         // snapshot is only called when a new frame has to be drawn
+         void
+         render (const RefPtr<Context>& cr,
+                 const Size_2D& size_2d,
+                 const Dstring& key,
+                 const function<Draw ()>& snapshot);
+
+   };
+
+   // A thread that runs the latest job posted to it.  Posting a job
+   // cancels the one in flight and replaces one not yet started, so the
+   // poster never waits.
+   class Worker
+   {
+
+      public:
+
+         typedef function<void (const function<bool ()>& is_cancelled)>
+         Job;
+
+      private:
+
+         Job
+         job;
+
+         std::atomic<Integer>
+         generation;
+
+         bool
+         stopping;
+
+         std::mutex
+         mutex;
+
+         std::condition_variable
+         condition;
+
+         std::thread
+         thread;
+
+         void
+         run ();
+
+      public:
+
+         Worker ();
+
+         ~Worker ();
+
+         void
+         post (const Job& job);
+
+         void
+         cancel ();
+
+         // cancels and waits for the job in flight; nothing runs after
+         void
+         stop ();
+
+   };
+
+   // Writes frames recorded on the UI thread out as PNG, PDF or SVG,
+   // one after another on a worker, at any scale.  A PNG is drawn whole
+   // into one image surface, four bytes a pixel at the scaled size.
+   class Exporter
+   {
+
+      public:
+
+         class Job
+         {
+
+            public:
+
+               // a recording surface of the frame
+               RefPtr<Surface>
+               recording;
+
+               Size_2D
+               size_2d;
+
+               Dstring
+               file_path;
+
+               Real
+               scale;
+
+               Job ();
+
+         };
+
+      private:
+
+         const function<void (const Dstring&)>
+         on_done;
+
+         list<Job>
+         job_list;
+
+         // results not yet reported, in order
+         vector<Dstring>
+         message_tuple;
+
+         bool
+         stopping;
+
+         std::mutex
+         mutex;
+
+         std::condition_variable
+         condition;
+
+         Glib::Dispatcher
+         dispatcher;
+
+         std::thread
+         thread;
+
+         void
+         run ();
+
+         void
+         on_dispatch ();
+
+      public:
+
+         // jobs pushed and not yet reported
+         Integer
+         pending_count;
+
+         Exporter (const function<void (const Dstring&)>& on_done);
+
+         ~Exporter ();
+
+         void
+         push (Job&& job);
+
+         static void
+         write (const Job& job);
+
    };
 
    class Nine2five : public Dcanvas
@@ -160,18 +733,333 @@ namespace nine2five
          bool
          defining_predictor;
 
+         // shared with the queries that read them, so that a rebuild
+         // never frees one still being scanned
+         shared_ptr<const Archive>
+         archive_ptr;
+
+         Dstring
+         archive_station;
+
+         shared_ptr<const Trajectory_Index>
+         trajectory_index_ptr;
+
+         Record::Columns*
+         columns_ptr;
+
+         Dstring
+         columns_key;
+
+         // analog queries run on a worker; a newer one bumps the
+         // generation, which the one in flight checks as it scans
+         Dstring
+         query_key;
+
+         Record::Columns*
+         pending_columns_ptr;
+
+         Dstring
+         pending_columns_key;
+
+         std::thread
+         query_thread;
+
+         std::atomic<Integer>
+         query_generation;
+
+         std::mutex
+         query_mutex;
+
+         Glib::Dispatcher
+         query_dispatcher;
+
+         // analog sets worked out ahead, by columns key, for the times
+         // and stations either side of the current one, by a worker
+         // that is never waited for on the UI thread
+         class Prefetch_Job
+         {
+
+            public:
+
+               Dstring
+               key;
+
+               Dstring
+               station;
+
+               function<Record::Columns* (const Station_Data&,
+                                          const function<bool ()>&)>
+               query;
+
+               // nullptr for a station not read yet
+               const Station_Data*
+               station_data_ptr;
+
+         };
+
+         class Prefetched
+         {
+
+            public:
+
+               Dstring
+               key;
+
+               Dstring
+               station;
+
+               // nullptr when the query was cancelled
+               Record::Columns*
+               columns_ptr;
+
+               // what the worker read, for Data to take over
+               Station_Data*
+               station_data_ptr;
+
+         };
+
+         map<Dstring, Record::Columns*>
+         prefetch_map;
+
+         list<Prefetch_Job>
+         prefetch_job_list;
+
+         vector<Prefetched>
+         prefetched_tuple;
+
+         // stations the worker is reading or has read, not yet in data
+         set<Dstring>
+         prefetch_read_set;
+
+         std::atomic<Integer>
+         prefetch_generation;
+
+         std::atomic<bool>
+         prefetch_stopping;
+
+         std::mutex
+         prefetch_mutex;
+
+         std::condition_variable
+         prefetch_condition;
+
+         Glib::Dispatcher
+         prefetch_dispatcher;
+
+         std::thread
+         prefetch_thread;
+
+         Record::Projection
+         projection;
+
+         Histogram_1D
+         histogram;
+
+         bool
+         summarized;
+
+         // automatic clusters are redone whenever the analog set changes
+         Dstring
+         grouping;
+
+         bool
+         grouped;
+
+         // the intervals shown; newer ones are drawn off the main thread
+         Bootstrap
+         bootstrap;
+
+         Dstring
+         bootstrap_key;
+
+         Bootstrap
+         pending_bootstrap;
+
+         Dstring
+         pending_bootstrap_key;
+
+         Dstring
+         requested_bootstrap_key;
+
+         std::mutex
+         bootstrap_mutex;
+
+         Glib::Dispatcher
+         bootstrap_dispatcher;
+
+         Worker
+         bootstrap_worker;
+
+         Sensitivity
+         wind_925_sensitivity;
+
+         Sensitivity
+         day_of_year_sensitivity;
+
+         Dstring
+         sensitivity_key;
+
+         // queried and swept off the main thread; a newer request
+         // cancels the one in flight
+         Sensitivity
+         pending_wind_925_sensitivity;
+
+         Sensitivity
+         pending_day_of_year_sensitivity;
+
+         Dstring
+         pending_sensitivity_key;
+
+         Dstring
+         requested_sensitivity_key;
+
+         std::mutex
+         sensitivity_mutex;
+
+         Glib::Dispatcher
+         sensitivity_dispatcher;
+
+         Worker
+         sensitivity_worker;
+
+         // the surface is queried and computed off the main thread; a
+         // newer request cancels the one in flight
+         Response_Surface*
+         surface_ptr;
+
+         Dstring
+         surface_key;
+
+         Response_Surface*
+         pending_surface_ptr;
+
+         Dstring
+         pending_surface_key;
+
+         Dstring
+         requested_surface_key;
+
+         std::mutex
+         surface_mutex;
+
+         Glib::Dispatcher
+         surface_dispatcher;
+
+         Worker
+         surface_worker;
+
+         // bumped whenever the wind rose and histogram are fed again
+         Integer
+         summary_version;
+
+         // declared before the layers, whose worker draws with it
+         Scatter_Plot
+         scatter_plot;
+
+         Layer
+         disc_layer;
+
+         Async_Layer
+         scatter_layer;
+
+         Layer
+         statistics_layer;
+
+         // motion and scroll redraws are held to one per display frame;
+         // later events merge into the pending one; 0 when no tick is armed
+         guint
+         frame_tick_id;
+
+         Integer
+         event_count;
+
+         Integer
+         merged_count;
+
+         Integer
+         dropped_count;
+
+         Integer
+         frame_count;
+
+         bool
+         with_frame_stats;
+
+         Stage
+         snapshot_stage;
+
+         Stage
+         query_stage;
+
+         Stage
+         projection_stage;
+
+         Stage
+         clusters_stage;
+
+         Stage
+         statistics_stage;
+
+         Stage
+         disc_layer_stage;
+
+         Stage
+         scatter_layer_stage;
+
+         Stage
+         statistics_layer_stage;
+
+         // in order, for the debug view
+         vector<Stage*>
+         stage_ptr_tuple;
+
+         bool
+         with_pipeline_view;
+
+         // declared after everything its jobs read, so that it is
+         // destroyed first
+         Playback
+         playback;
+
+         sigc::connection
+         play_connection;
+
+         // ticks at which the next frame was not ready
+         Integer
+         stall_count;
+
+         // folder the frames are written to while exporting, else empty
+         Dstring
+         export_path;
+
+         Integer
+         export_count;
+
+         Exporter
+         exporter;
+
+         // the last export result, shown for a few seconds
+         Dstring
+         export_message;
+
+         sigc::connection
+         message_connection;
+
+         // while a frame is recorded for saving
+         bool
+         recording;
+
          virtual void
          pack ();
 
          void
          render_histogram (const RefPtr<Context>& cr,
-                           const Record::Set& record_set,
                            const Predictor& predictor) const;
 
-         void
-         render_scatter_plot (const RefPtr<Context>& cr,
-                              const Record::Set& record_set,
-                              const Real dir_scatter) const;
+         Async_Layer::Draw
+         get_scatter_draw (const Record::Columns& columns,
+                           const Record::Projection& projection,
+                           const bool with_noise) const;
 
          void
          render_predictor (const RefPtr<Context>& cr,
@@ -183,6 +1071,128 @@ namespace nine2five
                  const Dtime& dtime,
                  const Predictor& predictor);
 
+         void
+         group (const Record::Columns& columns);
+
+         typedef function<Record::Columns* (const Station_Data&,
+                                            const function<bool ()>&)>
+         Query;
+
+         Dstring
+         get_columns_key (const Dstring& station,
+                          const Dtime& dtime,
+                          const Predictor& predictor) const;
+
+         Query
+         get_query (const Dtime& dtime,
+                    const Predictor& predictor);
+
+         void
+         cancel_queries ();
+
+         void
+         prefetch ();
+
+         void
+         run_prefetch ();
+
+         void
+         on_prefetch_ready ();
+
+         void
+         set_columns (Record::Columns* columns_ptr,
+                      const Dstring& key);
+
+         void
+         on_query_ready ();
+
+         const Archive&
+         get_archive ();
+
+         const Trajectory_Index&
+         get_trajectory_index (const Integer hours);
+
+         bool
+         get_trajectory (Tuple& u_tuple,
+                         Tuple& v_tuple,
+                         const Dtime& dtime,
+                         const Predictor& predictor,
+                         const Tuple& lag_tuple) const;
+
+         void
+         update_sensitivity (const Dtime& dtime,
+                             const Predictor& predictor);
+
+         void
+         update_bootstrap (const Predictor& predictor);
+
+         void
+         on_bootstrap_ready ();
+
+         void
+         on_sensitivity_ready ();
+
+         void
+         render_sensitivity (const RefPtr<Context>& cr) const;
+
+         Dstring
+         get_surface_key (const Dtime& dtime,
+                          const Predictor& predictor) const;
+
+         void
+         update_surface (const Dtime& dtime,
+                         const Predictor& predictor);
+
+         void
+         on_surface_ready ();
+
+         Dstring
+         get_disc_key () const;
+
+         Dstring
+         get_clusters_key () const;
+
+         void
+         queue_frame (const bool superseding);
+
+         bool
+         on_frame_tick (const Glib::RefPtr<Gdk::FrameClock>& frame_clock);
+
+         void
+         on_frame ();
+
+         void
+         flush_frame ();
+
+         void
+         render_frame_stats (const RefPtr<Context>& cr) const;
+
+         void
+         render_pipeline (const RefPtr<Context>& cr) const;
+
+         const Predictor&
+         get_play_predictor (const Dtime& dtime) const;
+
+         void
+         fill_playback ();
+
+         bool
+         on_play_tick ();
+
+         void
+         stop_playback ();
+
+         RefPtr<Surface>
+         record ();
+
+         void
+         on_export_done (const Dstring& message);
+
+         bool
+         clear_export_message ();
+
+         void
+         render_status (const RefPtr<Context>& cr) const;
 
       public:
 
@@ -201,7 +1211,14 @@ namespace nine2five
          save_image ();
 
          bool
-         save (const Dstring& file_path);
+         save (const Dstring& file_path,
+               const Real scale = 1);
+
+         void
+         update_playback ();
+
+         void
+         export_series ();
 
          virtual void
          set_station (const Dstring& station);
@@ -210,6 +1227,10 @@ namespace nine2five
          get_record_set_ptr (const Dtime& dtime,
                              const Predictor& predictor);
 
+         const Record::Columns&
+         get_columns (const Dtime& dtime,
+                      const Predictor& predictor);
+
          virtual bool
          on_key_pressed (const Dkey_Event& event);
 
@@ -240,6 +1261,15 @@ namespace nine2five
          virtual void
          make_calm_cluster (const Dstring& str);
 
+         virtual void
+         make_sector_cluster (const Dstring& str);
+
+         virtual void
+         make_auto_clusters (const Dstring& str);
+
+         virtual void
+         regroup ();
+
    };
 
 };
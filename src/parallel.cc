@@ -0,0 +1,82 @@
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "parallel.h"
+
+using namespace nine2five;
+
+static thread_local Integer
+thread_limit = 0;
+
+Chunks::Chunks (const Integer n,
+                const Integer chunk_size)
+   : n (n),
+     chunk_size (chunk_size)
+{
+}
+
+Integer
+Chunks::size () const
+{
+   return (n + chunk_size - 1) / chunk_size;
+}
+
+Integer
+Chunks::get_start (const Integer chunk) const
+{
+   return chunk * chunk_size;
+}
+
+Integer
+Chunks::get_end (const Integer chunk) const
+{
+   return std::min (n, (chunk + 1) * chunk_size);
+}
+
+Integer
+Chunks::get_number_of_threads ()
+{
+   if (thread_limit > 0) { return thread_limit; }
+   const Integer number_of_threads = thread::hardware_concurrency ();
+   return std::max (number_of_threads, 1);
+}
+
+void
+Chunks::set_number_of_threads (const Integer number_of_threads)
+{
+   thread_limit = number_of_threads;
+}
+
+void
+Chunks::run (const function<void (const Integer chunk)>& job,
+             const Integer number_of_threads) const
+{
+
+   const Integer number_of_chunks = size ();
+   const Integer nt = (number_of_threads > 0 ?
+      number_of_threads : get_number_of_threads ());
+   const Integer number_of_workers = std::min (nt, number_of_chunks);
+
+   // small jobs are not worth a thread
+   if (number_of_workers < 2)
+   {
+      for (Integer c = 0; c < number_of_chunks; c++) { job (c); }
+      return;
+   }
+
+   atomic<Integer> next (0);
+   auto work = [&] ()
+   {
+      for (Integer c = next++; c < number_of_chunks; c = next++) { job (c); }
+   };
+
+   vector<thread> thread_tuple;
+   for (Integer t = 1; t < number_of_workers; t++)
+   {
+      thread_tuple.push_back (thread (work));
+   }
+
+   work ();
+   for (thread& t : thread_tuple) { t.join (); }
+
+}
@@ -0,0 +1,56 @@
+#ifndef NINE2FIVE_PARALLEL_H
+#define NINE2FIVE_PARALLEL_H
+
+#include <functional>
+#include <denise/gtkmm.h>
+
+using namespace std;
+using namespace denise;
+
+namespace nine2five
+{
+
+   // Splits [0, n) into chunks of a fixed size and hands them out to a
+   // pool of threads.  Chunk boundaries depend only on n and chunk_size,
+   // so partial results merged in chunk order come out the same bit for
+   // bit whatever the number of threads.
+   class Chunks
+   {
+
+      public:
+
+         const Integer
+         n;
+
+         const Integer
+         chunk_size;
+
+         Chunks (const Integer n,
+                 const Integer chunk_size = 16384);
+
+         Integer
+         size () const;
+
+         Integer
+         get_start (const Integer chunk) const;
+
+         Integer
+         get_end (const Integer chunk) const;
+
+         static Integer
+         get_number_of_threads ();
+
+         // caps run on the calling thread only; 1 keeps the chunks of a
+         // job that already runs in a pool on that pool thread
+         static void
+         set_number_of_threads (const Integer number_of_threads);
+
+         void
+         run (const function<void (const Integer chunk)>& job,
+              const Integer number_of_threads = 0) const;
+
+   };
+
+};
+
+#endif /* NINE2FIVE_PARALLEL_H */
@@ -0,0 +1,287 @@
+#ifndef NINE2FIVE_SCHEMA_H
+#define NINE2FIVE_SCHEMA_H
+
+#include <array>
+#include <tuple>
+#include <utility>
+#include <denise/gtkmm.h>
+#include <denise/met.h>
+
+using namespace std;
+
+namespace nine2five
+{
+
+   // Predictor columns that can follow the six fixed fields of a station
+   // file.  Each one says how many colon-separated fields it reads, how to
+   // parse them, and the distance between two values for analog matching.
+
+   class Wind_850
+   {
+
+      public:
+
+         typedef Wind
+         Value;
+
+         static const Integer
+         number_of_fields = 2;
+
+         // direction in degrees, speed in m/s as for the 925 hPa wind
+         static Value
+         parse (const Tokens& tokens,
+                const Integer offset)
+         {
+            const Real direction = stof (tokens[offset]);
+            const Real speed = stof (tokens[offset + 1]);
+            return Wind::direction_speed (direction, speed);
+         }
+
+         static Value
+         nil ()
+         {
+            return Wind (GSL_NAN, GSL_NAN);
+         }
+
+         // vector difference in knots
+         static Real
+         get_distance (const Value& a,
+                       const Value& b)
+         {
+            return (a - b).get_speed () / 0.51444444;
+         }
+
+   };
+
+   class Mslp_Gradient
+   {
+
+      public:
+
+         typedef Real
+         Value;
+
+         static const Integer
+         number_of_fields = 1;
+
+         // hPa per 100 km
+         static Value
+         parse (const Tokens& tokens,
+                const Integer offset)
+         {
+            return stof (tokens[offset]);
+         }
+
+         static Value
+         nil ()
+         {
+            return GSL_NAN;
+         }
+
+         static Real
+         get_distance (const Value& a,
+                       const Value& b)
+         {
+            return fabs (a - b);
+         }
+
+   };
+
+   class Dew_Point
+   {
+
+      public:
+
+         typedef Real
+         Value;
+
+         static const Integer
+         number_of_fields = 1;
+
+         static Value
+         parse (const Tokens& tokens,
+                const Integer offset)
+         {
+            return stof (tokens[offset]);
+         }
+
+         static Value
+         nil ()
+         {
+            return GSL_NAN;
+         }
+
+         static Real
+         get_distance (const Value& a,
+                       const Value& b)
+         {
+            return fabs (a - b);
+         }
+
+   };
+
+   // A fixed list of extra predictor columns.  Parsing, columnar storage,
+   // the hard threshold match and the kernel weight are all expanded over
+   // the list at compile time, so Schema<> stores and does nothing.
+   template <typename... Column>
+   class Schema
+   {
+
+      public:
+
+         typedef tuple<typename Column::Value...>
+         Values;
+
+         typedef tuple<vector<typename Column::Value>...>
+         Storage;
+
+         static const Integer
+         number_of_columns = sizeof... (Column);
+
+         static const Integer
+         number_of_fields = (Integer (0) + ... + Column::number_of_fields);
+
+         // Query value and threshold of each column; a NaN threshold
+         // leaves that column out.  Records missing an active column
+         // never match.
+         class Query
+         {
+
+            public:
+
+               Values
+               values;
+
+               array<Real, sizeof... (Column)>
+               threshold_array;
+
+               Query ()
+                  : values (Schema::nil ())
+               {
+                  threshold_array.fill (GSL_NAN);
+               }
+
+               template <typename C, size_t I> bool
+               match (const typename C::Value& value) const
+               {
+                  const Real threshold = threshold_array[I];
+                  if (gsl_isnan (threshold)) { return true; }
+                  return (C::get_distance (value, get<I> (values)) < threshold);
+               }
+
+               // the threshold is the kernel scale, as for the 925 hPa wind
+               template <typename C, size_t I> Real
+               get_exponent (const typename C::Value& value) const
+               {
+                  const Real threshold = threshold_array[I];
+                  if (gsl_isnan (threshold)) { return 0; }
+                  const Real d = C::get_distance (value, get<I> (values));
+                  if (gsl_isnan (d)) { return GSL_NEGINF; }
+                  return -0.5 * (d * d) / (threshold * threshold);
+               }
+
+         };
+
+      private:
+
+         typedef index_sequence_for<Column...>
+         Indices;
+
+         template <typename C> static typename C::Value
+         parse_column (const Tokens& tokens,
+                       Integer& offset)
+         {
+            const Integer o = offset;
+            offset += C::number_of_fields;
+            const bool missing = (o + C::number_of_fields > tokens.size ());
+            return (missing ? C::nil () : C::parse (tokens, o));
+         }
+
+         template <size_t... I> static void
+         push_back (Storage& storage,
+                    const Values& values,
+                    index_sequence<I...>)
+         {
+            (get<I> (storage).push_back (get<I> (values)), ...);
+         }
+
+         template <size_t... I> static Values
+         get_values (const Storage& storage,
+                     const Integer k,
+                     index_sequence<I...>)
+         {
+            return Values (get<I> (storage)[k]...);
+         }
+
+         template <size_t... I> static bool
+         match (const Values& values,
+                const Query& query,
+                index_sequence<I...>)
+         {
+            return (query.template match<Column, I> (get<I> (values)) && ...);
+         }
+
+         template <size_t... I> static Real
+         get_exponent (const Values& values,
+                       const Query& query,
+                       index_sequence<I...>)
+         {
+            return (Real (0) + ... +
+               query.template get_exponent<Column, I> (get<I> (values)));
+         }
+
+      public:
+
+         static Values
+         nil ()
+         {
+            return Values (Column::nil ()...);
+         }
+
+         // columns start at offset, in declared order; short lines give nil
+         static Values
+         parse (const Tokens& tokens,
+                const Integer offset)
+         {
+            Integer o = offset;
+            return Values { parse_column<Column> (tokens, o)... };
+         }
+
+         static void
+         push_back (Storage& storage,
+                    const Values& values)
+         {
+            push_back (storage, values, Indices ());
+         }
+
+         static Values
+         get_values (const Storage& storage,
+                     const Integer k)
+         {
+            return get_values (storage, k, Indices ());
+         }
+
+         static bool
+         match (const Values& values,
+                const Query& query)
+         {
+            return match (values, query, Indices ());
+         }
+
+         static Real
+         get_exponent (const Values& values,
+                       const Query& query)
+         {
+            return get_exponent (values, query, Indices ());
+         }
+
+   };
+
+   // Extra columns read after the six fixed fields; for example
+   // Schema<Wind_850, Mslp_Gradient, Dew_Point>
+   typedef Schema<>
+   Extra_Schema;
+
+};
+
+#endif /* NINE2FIVE_SCHEMA_H */